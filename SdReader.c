@@ -1,9 +1,12 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include <compat/deprecated.h>
 #include "globals.h"
 #include "SdReader.h"
 #include "WavePinDefs.h"
+#include "syncro.h"
+#include "os.h"
 
 uint32_t block_;
 uint8_t errorCode_=0;
@@ -14,6 +17,16 @@ uint8_t partialBlockRead_=0;
 uint8_t response_;
 uint8_t type_=0;
 
+// asynchronous read state, advanced by the SPI transfer complete interrupt
+volatile uint8_t asyncBusy_=0;
+volatile uint8_t *asyncDst_;
+volatile uint16_t asyncSkip_;
+volatile uint16_t asyncCount_;
+volatile uint16_t asyncTail_;
+uint16_t asyncEnd_;
+semaphore_t *asyncDone_;
+semaphore_t readDone_;
+
 //------------------------------------------------------------------------------
 // inline SPI functions
 /** Send a byte to the card */
@@ -96,6 +109,7 @@ uint8_t sdCardCommand(uint8_t cmd, uint32_t arg) {
 
    // end read if in partialBlockRead mode
    sdReadEnd();
+   TRACE(TRACE_SD_COMMAND, cmd);
 
    // select card
    spiSSLow();
@@ -117,6 +131,7 @@ uint8_t sdCardCommand(uint8_t cmd, uint32_t arg) {
 
    // wait for response
    for (retry = 0; ((r1 = spiRec()) & 0X80) && retry != 0XFF; retry++);
+   TRACE(TRACE_SD_RESPONSE, r1);
 
    return r1;
 }
@@ -167,6 +182,8 @@ uint8_t sdInit(uint8_t slow) {
    uint8_t retry;
    uint32_t t0=0;
 
+   sem_init(&readDone_, 0);
+
    //pinMode(SS, OUTPUT);
    DDRB |= _BV(SS);
 
@@ -279,21 +296,9 @@ uint8_t sdReadData(uint32_t block,
    if ((count + offset) > 512) {
       return 0;
    }
-   if (!inBlock_ || block != block_ || offset < offset_) {
-      block_ = block;
-
-      // use address if not SDHC card
-      if (sdType()!= SD_CARD_TYPE_SDHC) block <<= 9;
-      if (sdCardCommand(CMD17, block)) {
-         error1(SD_CARD_ERROR_CMD17);
-         return 0;
-      }
-      if (!sdWaitStartBlock()) {
-         return 0;
-      }
-      offset_ = 0;
-      inBlock_ = 1;
-   }
+   // never interleave with a transfer owned by the interrupt
+   while (asyncBusy_);
+   if (!sdStartRead(block, offset)) return 0;
 
    // start first SPI transfer
    SPDR = 0XFF;
@@ -320,9 +325,125 @@ uint8_t sdReadData(uint32_t block,
    return 1;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * Issue CMD17 for \a block unless the card is already streaming it and
+ * \a offset has not been passed yet.
+ *
+ * \return The value one, true, is returned for success and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t sdStartRead(uint32_t block, uint16_t offset) {
+   if (!inBlock_ || block != block_ || offset < offset_) {
+      block_ = block;
+
+      // use address if not SDHC card
+      if (sdType()!= SD_CARD_TYPE_SDHC) block <<= 9;
+      if (sdCardCommand(CMD17, block)) {
+         error1(SD_CARD_ERROR_CMD17);
+         return 0;
+      }
+      if (!sdWaitStartBlock()) {
+         return 0;
+      }
+      offset_ = 0;
+      inBlock_ = 1;
+   }
+   return 1;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * Start an interrupt driven read of part of a 512 byte block.
+ *
+ * The command and start token are handled before returning, the data
+ * phase is clocked by the SPI transfer complete interrupt one byte at a
+ * time.  \a done is signaled from the interrupt once \a dst is filled.
+ *
+ * \param[in] block Logical block to be read.
+ * \param[in] offset Number of bytes to skip at start of block
+ * \param[out] dst Pointer to the location that will receive the data.
+ * \param[in] count Number of bytes to read
+ * \param[in] done Semaphore to signal on completion, may be NULL.
+ * \return The value one, true, is returned if the transfer was started and
+ * the value zero, false, is returned for failure.
+ */
+uint8_t sdReadDataAsync(uint32_t block, uint16_t offset,
+      uint8_t *dst, uint16_t count, semaphore_t *done) {
+   if (count == 0 || (count + offset) > 512) return 0;
+   while (asyncBusy_);
+   if (!sdStartRead(block, offset)) return 0;
+
+   asyncDst_ = dst;
+   asyncSkip_ = offset - offset_;
+   asyncCount_ = count;
+   asyncEnd_ = offset + count;
+   // data left in the block plus two crc bytes
+   asyncTail_ = (!partialBlockRead_ || asyncEnd_ >= 512) ? 514 - asyncEnd_ : 0;
+   asyncDone_ = done;
+   asyncBusy_ = 1;
+
+   // interrupt on transfer complete and start the first transfer
+   SPCR |= (1 << SPIE);
+   SPDR = 0XFF;
+   return 1;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * Read part of a 512 byte block, blocking the calling thread on a
+ * semaphore while the data phase runs from the SPI interrupt.
+ *
+ * Must only be called from a thread once the scheduler is running.
+ */
+uint8_t sdReadDataSleep(uint32_t block,
+      uint16_t offset, uint8_t *dst, uint16_t count) {
+   if (count == 0) return 1;
+   if (!sdReadDataAsync(block, offset, dst, count, &readDone_)) return 0;
+   sem_wait(&readDone_);
+   return 1;
+}
+
+/** Return nonzero while an asynchronous read is in progress. */
+uint8_t sdReadBusy(void) {return asyncBusy_;}
+
+//------------------------------------------------------------------------------
+// SPI transfer complete, clock the next byte of an asynchronous read
+ISR(SPI_STC_vect) {
+   uint8_t b = SPDR;
+
+   if (asyncSkip_) {
+      asyncSkip_--;
+   }
+   else if (asyncCount_) {
+      *asyncDst_++ = b;
+      asyncCount_--;
+   }
+   else if (asyncTail_) {
+      asyncTail_--;
+   }
+
+   if (asyncSkip_ || asyncCount_ || asyncTail_) {
+      SPDR = 0XFF;
+      return;
+   }
+
+   // transfer done, back to polled mode
+   SPCR &= ~(1 << SPIE);
+   offset_ = asyncEnd_;
+   if (!partialBlockRead_ || offset_ >= 512) {
+      spiSSHigh();
+      inBlock_ = 0;
+   }
+   asyncBusy_ = 0;
+   TRACE(TRACE_SD_DATA, 0);
+   if (asyncDone_) sem_signal_isr(asyncDone_);
+}
+
 //------------------------------------------------------------------------------
 /** Skip remaining data in a block when in partial block read mode. */
 void sdReadEnd(void) {
+   while (asyncBusy_);
    if (inBlock_) {
       // skip data and crc
       SPDR = 0XFF;
@@ -357,14 +478,44 @@ uint8_t sdReadRegister(uint8_t cmd, uint8_t *dst) {
    return 1;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * Start timing a card wait.  Uses kernel ticks once the scheduler is
+ * running, otherwise the wait counts 2 us busy delays.
+ */
+uint32_t sdPollStart(void) {
+   return os_running() ? getTicks() : 0;
+}
+
+/**
+ * Delay between two polls of the card.  Spins for the first SD_SPIN_POLLS
+ * polls, after that the calling thread sleeps a tick per poll so the
+ * threads below it keep running.
+ *
+ * \return The value zero, false, once \a timeoutMillis has passed.
+ */
+uint8_t sdPollDelay(uint16_t *polls, uint32_t *t0, uint16_t timeoutMillis) {
+   if (!os_running()) {
+      (*t0)++;
+      _delay_us(2);
+      return (*t0/1000) <= timeoutMillis;
+   }
+   if (*polls < SD_SPIN_POLLS) {
+      (*polls)++;
+      return 1;
+   }
+   if (getTicks() - *t0 > ms_to_ticks(timeoutMillis)) return 0;
+   thread_sleep(1);
+   return 1;
+}
+
 //------------------------------------------------------------------------------
 // wait for card to go not busy
 uint8_t sdWaitNotBusy(uint16_t timeoutMillis) {
-   uint32_t t0 = 0;
+   uint16_t polls = 0;
+   uint32_t t0 = sdPollStart();
    while (spiRec() != 0XFF) {
-      t0++;
-      _delay_us(2);
-      if ((t0/1000) > timeoutMillis) return 0;
+      if (!sdPollDelay(&polls, &t0, timeoutMillis)) return 0;
    }
    return 1;
 }
@@ -373,11 +524,10 @@ uint8_t sdWaitNotBusy(uint16_t timeoutMillis) {
 /** Wait for start block token */
 uint8_t sdWaitStartBlock(void) {
    uint8_t r;
-   uint32_t t0 = 0;
+   uint16_t polls = 0;
+   uint32_t t0 = sdPollStart();
    while ((r = spiRec()) == 0XFF) {
-      t0++;
-      _delay_us(2);
-      if ((t0/1000) > SD_READ_TIMEOUT) {
+      if (!sdPollDelay(&polls, &t0, SD_READ_TIMEOUT)) {
          error1(SD_CARD_ERROR_READ_TIMEOUT);
          return 0;
       }
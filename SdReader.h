@@ -20,6 +20,7 @@
 #ifndef SdReader_h
 #define SdReader_h
 #include "SdInfo.h"
+#include "syncro.h"
 
 /**
  * Some SD card are very sensitive to the SPI bus speed for initialization.
@@ -37,6 +38,11 @@
 
 /** read timeout ms */
 #define SD_READ_TIMEOUT    300
+/**
+ * Number of busy polls before a wait starts sleeping a tick between polls.
+ * Only applies once the scheduler is running.
+ */
+#define SD_SPIN_POLLS      32
 
 // SD card errors
 /** timeout error for command CMD0 */
@@ -75,6 +81,11 @@ uint32_t cardSize(void);
 uint8_t sdInit(uint8_t slow);
 uint8_t sdWaitNotBusy(uint16_t timeoutMillis);
 uint8_t sdReadData(uint32_t block, uint16_t offset, uint8_t *dst, uint16_t count);
+uint8_t sdStartRead(uint32_t block, uint16_t offset);
+uint8_t sdReadDataAsync(uint32_t block, uint16_t offset, uint8_t *dst,
+      uint16_t count, semaphore_t *done);
+uint8_t sdReadDataSleep(uint32_t block, uint16_t offset, uint8_t *dst, uint16_t count);
+uint8_t sdReadBusy(void);
 void sdPartialBlockRead(uint8_t value);
 uint8_t sdReadBlock(uint32_t block, uint8_t *dst);
 uint8_t sdReadCID(cid_t* cid);
@@ -0,0 +1,148 @@
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#else
+//The host tools read the tables from plain memory
+#define PROGMEM
+#define pgm_read_byte(p) (*(p))
+#define pgm_read_word(p) (*(p))
+#endif
+#include "adpcm.h"
+#include "os.h"
+
+#define ADPCM_MAX_INDEX 88
+//The benchmark's codes and samples are on main()'s stack while it boots
+#define ADPCM_BENCH_BYTES 16
+
+//IMA step sizes
+const uint16_t adpcmSteps[ADPCM_MAX_INDEX + 1] PROGMEM = {
+   7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+   19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+   50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+   130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+   337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+   876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+   2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+   5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+   15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+//Step index change for the low 3 bits of a nibble
+const int8_t adpcmIndexAdjust[8] PROGMEM = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+//Starts a stream, the next byte decoded is the first byte of a block header
+void adpcmInit(struct adpcm_state* st, uint16_t blockAlign)
+{
+   st->predictor = 0x8000;
+   st->index = 0;
+   st->pos = 0;
+   st->blockAlign = blockAlign;
+}
+
+//Decodes one 4-bit code and returns the new sample as unsigned 8-bit
+//The predictor is kept in offset binary so the clamps are plain unsigned
+//compares and the output sample is just its high byte
+static inline uint8_t adpcmNibble(struct adpcm_state* st, uint8_t code)
+{
+   uint16_t step = pgm_read_word(&adpcmSteps[st->index]);
+   uint16_t diff = step >> 3;
+   uint16_t p = st->predictor;
+   int8_t index;
+
+   if(code & 4)
+      diff += step;
+   if(code & 2)
+      diff += step >> 1;
+   if(code & 1)
+      diff += step >> 2;
+
+   if(code & 8)
+      p = p < diff ? 0 : p - diff;
+   else
+      p = p > 0xFFFF - diff ? 0xFFFF : p + diff;
+
+   index = st->index + (int8_t)pgm_read_byte(&adpcmIndexAdjust[code & 7]);
+   if(index < 0)
+      index = 0;
+   else if(index > ADPCM_MAX_INDEX)
+      index = ADPCM_MAX_INDEX;
+
+   st->index = index;
+   st->predictor = p;
+   return p >> 8;
+}
+
+//Decodes |bytes| bytes of a mono stream from |src| into 8-bit samples at |dst|
+//Blocks may be split across calls at any byte, headers included
+//Returns the number of samples written, at most 2 * |bytes|
+uint16_t adpcmDecode(struct adpcm_state* st, const uint8_t* src, uint16_t bytes, uint8_t* dst)
+{
+   uint8_t* out = dst;
+   uint16_t run;
+   uint8_t b;
+
+   while(bytes)
+   {
+      //Header, the first sample is stored whole
+      if(st->pos < ADPCM_HEADER_SIZE)
+      {
+         b = *src++;
+         bytes--;
+         if(st->pos == 0)
+            st->predictor = b;
+         else if(st->pos == 1)
+         {
+            st->predictor = (st->predictor | ((uint16_t)b << 8)) ^ 0x8000;
+            *out++ = st->predictor >> 8;
+         }
+         else if(st->pos == 2)
+            st->index = b > ADPCM_MAX_INDEX ? ADPCM_MAX_INDEX : b;
+         st->pos++;
+         continue;
+      }
+
+      //Data, two codes per byte, low nibble first
+      run = st->blockAlign - st->pos;
+      if(run > bytes)
+         run = bytes;
+      bytes -= run;
+      st->pos += run;
+      for(; run; run--)
+      {
+         b = *src++;
+         *out++ = adpcmNibble(st, b & 0x0F);
+         *out++ = adpcmNibble(st, b >> 4);
+      }
+      if(st->pos == st->blockAlign)
+         st->pos = 0;
+   }
+   return out - dst;
+}
+
+#ifdef __AVR__
+//Times the decoder on a made up block with interrupts off
+//Returns CPU cycles per output sample
+uint16_t adpcmBenchmark()
+{
+   struct adpcm_state st;
+   uint8_t in[ADPCM_BENCH_BYTES];
+   uint8_t out[2 * ADPCM_BENCH_BYTES];
+   uint16_t stamp, samples;
+   uint32_t cycles;
+   uint8_t i, sreg;
+
+   //Codes that walk the step index up and down like real audio
+   for(i = 0; i < ADPCM_BENCH_BYTES; i++)
+      in[i] = i * 37 + 11;
+   adpcmInit(&st, ADPCM_BENCH_BYTES + ADPCM_HEADER_SIZE);
+   st.pos = ADPCM_HEADER_SIZE;
+
+   sreg = SREG;
+   cli();
+   stamp = cycle_stamp();
+   samples = adpcmDecode(&st, in, ADPCM_BENCH_BYTES, out);
+   cycles = cycles_since(stamp);
+   SREG = sreg;
+   return cycles / samples;
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef ADPCM_H
+#define ADPCM_H
+#include <stdint.h>
+
+#define ADPCM_HEADER_SIZE 4  //first sample, step index, reserved
+
+//Decoder state for one mono IMA/DVI ADPCM stream
+struct adpcm_state {
+   uint16_t predictor;  //Last sample in offset binary, 0x8000 is silence
+   uint16_t pos;        //Byte offset inside the current block
+   uint16_t blockAlign; //Bytes per block, header included
+   uint8_t index;       //Step table index
+};
+
+void adpcmInit(struct adpcm_state* st, uint16_t blockAlign);
+uint16_t adpcmDecode(struct adpcm_state* st, const uint8_t* src, uint16_t bytes, uint8_t* dst);
+uint16_t adpcmBenchmark();
+
+#endif
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Builds ext2 fixture images for fsbench and lists them as "image songs"
+# usage: fixtures.sh outdir
+set -e
+out=${1:-bench/fixtures}
+MKE2FS=${MKE2FS:-mke2fs}
+mkdir -p "$out"
+: > "$out/list"
+
+# fixture name, song count, song size in KB, block size
+fixture() {
+   name=$1; songs=$2; kb=$3; bs=$4
+   img="$out/$name.img"
+   dir="$out/$name.d"
+   rm -rf "$dir"
+   mkdir -p "$dir"
+   i=0
+   while [ $i -lt $songs ]; do
+      head -c $((kb * 1024)) /dev/urandom > "$dir/song$i.raw"
+      i=$((i + 1))
+   done
+   # data plus metadata overhead and room for lost+found
+   total=$((songs * kb * 11 / 10 + 1024))
+   rm -f "$img"
+   $MKE2FS -q -F -t ext2 -b $bs -d "$dir" "$img" ${total}k
+   rm -rf "$dir"
+   echo "$img $songs" >> "$out/list"
+}
+
+# song count
+fixture songs4_64k_b1024 4 64 1024
+fixture songs13_64k_b1024 13 64 1024
+fixture songs40_64k_b1024 40 64 1024
+# song size, 1 MB and up reach the double indirect blocks
+fixture songs4_16k_b1024 4 16 1024
+fixture songs4_1m_b1024 4 1024 1024
+fixture songs2_4m_b1024 2 4096 1024
+# block size
+fixture songs13_256k_b1024 13 256 1024
+fixture songs13_256k_b2048 13 256 2048
+fixture songs13_256k_b4096 13 256 4096
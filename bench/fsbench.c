@@ -0,0 +1,166 @@
+//Host benchmark for the ext2 read path
+//Runs ext.c against an image file and counts what the card would have to do
+//to open every song and stream it the way the loader does
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../blockdev.h"
+#include "../ext.h"
+#include "../globals.h"
+
+#define CMD_BYTES 8        //command, argument, crc and response
+#define CRC_BYTES 2
+
+//Card timing model, overridden from the command line
+uint32_t spiHz = 8000000;
+uint32_t cmdLatencyUs = 500;
+uint32_t sampleRate = 11049;
+//Bytes the loader asks extReadFile() for at a time, a readahead block of
+//8-bit mono, or RAW_CHUNK for wider frames
+uint16_t readSize = BUFFER_SIZE;
+
+//What the card saw
+struct card_stats {
+   uint32_t commands;
+   uint64_t wireBytes;
+   uint64_t bytes;
+};
+
+struct block_device* image;
+struct block_device card;
+struct card_stats cardStats;
+
+uint8_t cardRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count)
+{
+   cardStats.commands++;
+   //Without partial block reads every CMD17 clocks the whole sector and crc
+   cardStats.wireBytes += CMD_BYTES + BLOCKDEV_SECTOR_SIZE + CRC_BYTES;
+   cardStats.bytes += count;
+   return bdRead(image, sector, offset, dst, count);
+}
+
+uint8_t cardGeometry(struct block_device* dev, struct blockdev_geometry* geo)
+{
+   return bdGeometry(image, geo);
+}
+
+//Simulated card time for |s| in microseconds
+double cardTimeUs(struct card_stats* s)
+{
+   return s->commands * (double)cmdLatencyUs + s->wireBytes * 8.0 * 1e6 / spiHz;
+}
+
+void report(const char* op, uint32_t calls, struct card_stats* s)
+{
+   printf("  %-14s %8u calls %9u cmds %8.2f cmds/call %11llu bytes %10.1f ms\n",
+      op, calls, s->commands, calls ? (double)s->commands / calls : 0.0,
+      (unsigned long long)s->bytes, cardTimeUs(s) / 1000);
+}
+
+void statsDelta(struct card_stats* start, struct card_stats* out)
+{
+   out->commands = cardStats.commands - start->commands;
+   out->wireBytes = cardStats.wireBytes - start->wireBytes;
+   out->bytes = cardStats.bytes - start->bytes;
+}
+
+void usage(const char* name)
+{
+   fprintf(stderr, "usage: %s [-s spi_hz] [-l cmd_latency_us] [-r sample_rate] "
+      "[-b read_bytes] -n songs image\n", name);
+   exit(2);
+}
+
+int main(int argc, char** argv)
+{
+   struct block_device host;
+   struct card_stats start, opens, stream;
+   struct ext_file* files;
+   char name[MAX_NAME_LEN];
+   uint8_t* buffer;
+   uint32_t songs = 0, calls = 0, audioBytes = 0, pos;
+   uint16_t got;
+   int opt;
+   uint16_t i;
+   double seconds;
+
+   while((opt = getopt(argc, argv, "s:l:r:b:n:")) != -1)
+   {
+      switch(opt)
+      {
+         case 's': spiHz = strtoul(optarg, NULL, 0); break;
+         case 'l': cmdLatencyUs = strtoul(optarg, NULL, 0); break;
+         case 'r': sampleRate = strtoul(optarg, NULL, 0); break;
+         case 'b': readSize = strtoul(optarg, NULL, 0); break;
+         case 'n': songs = strtoul(optarg, NULL, 0); break;
+         default: usage(argv[0]);
+      }
+   }
+   if(optind != argc - 1 || !songs || !readSize)
+      usage(argv[0]);
+
+   image = hostDiskOpen(&host, argv[optind]);
+   if(!image)
+   {
+      perror(argv[optind]);
+      return 1;
+   }
+   card.read = cardRead;
+   card.geometry = cardGeometry;
+   if(!extMount(&card))
+   {
+      fprintf(stderr, "%s: not an ext2 image\n", argv[optind]);
+      return 1;
+   }
+
+   printf("%s: %u songs, spi %u Hz, cmd %u us, %u samples/s, %u byte reads\n",
+      argv[optind], songs, spiHz, cmdLatencyUs, sampleRate, readSize);
+
+   //Open every song like a track change without the playlist index,
+   //the directory entry and the inode's block map
+   files = calloc(songs, sizeof(struct ext_file));
+   buffer = malloc(readSize);
+   start = cardStats;
+   for(i = 0; i < songs; i++)
+   {
+      if(!extOpen(i, &files[i], name))
+      {
+         fprintf(stderr, "%s: song %u won't open\n", argv[optind], i);
+         return 1;
+      }
+   }
+   statsDelta(&start, &opens);
+
+   //Stream every song the way load_audio_file() does, one read per block
+   start = cardStats;
+   for(i = 0; i < songs; i++)
+   {
+      for(pos = 0; (got = extReadFile(&files[i], pos, buffer, readSize)); pos += got)
+      {
+         calls++;
+         audioBytes += got;
+      }
+      if(pos != files[i].size)
+      {
+         fprintf(stderr, "%s: song %u stopped at %u of %u bytes\n", argv[optind], i,
+            pos, files[i].size);
+         return 1;
+      }
+   }
+   statsDelta(&start, &stream);
+
+   report("extOpen", songs, &opens);
+   report("extReadFile", calls, &stream);
+
+   seconds = (double)audioBytes / sampleRate;
+   printf("  per second of audio: %.1f cmds, %.0f bytes, %.1f ms card time (%.1f%% of real time)\n",
+      stream.commands / seconds, stream.bytes / seconds,
+      cardTimeUs(&stream) / 1000 / seconds, cardTimeUs(&stream) / 10000 / seconds);
+
+   free(files);
+   free(buffer);
+   hostDiskClose(&host);
+   return 0;
+}
@@ -0,0 +1,425 @@
+//Runs the firmware under simavr with an SD card model on the SPI bus that
+//serves sectors from an ext2 image, and measures the kernel and the read
+//path in simulated cycles: the context switch, the tick ISR, the boot
+//phases main() marks, and the rate the loader pulls data off the card.
+//
+//The symbols come from avr-nm -S on the same ELF, see make bench.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sim_avr.h>
+#include <sim_elf.h>
+#include <avr_ioport.h>
+#include <avr_spi.h>
+#include <avr_uart.h>
+#include "../blockdev.h"
+#include "../boot.h"
+
+#define F_CPU 16000000
+#define MCU "atmega328p"
+#define SRAM_BASE 0x800000     //Where avr-nm puts data addresses
+#define VECTOR_BYTES 104       //26 vectors of 2 words on the 328P
+#define OP_RETI 0x9518
+#define CS_PIN 2               //SS on port B, see WavePinDefs.h
+
+//Card responses, see SdInfo.h
+#define R1_IDLE_STATE 0x01
+#define R1_ILLEGAL_COMMAND 0x04
+#define R1_ADDRESS_ERROR 0x20
+#define DATA_START_BLOCK 0xFE
+//Longest response: R1, the access time, the start token, a sector and its crc
+#define CARD_OUT_MAX (1 + 255 + 1 + BLOCKDEV_SECTOR_SIZE + 2)
+
+//Bytes of 0xFF before a block's start token, overridden from the command line
+uint8_t accessBytes = 8;
+
+//An SDHC card in SPI mode, just enough of one for SdReader.c
+struct card_model {
+   uint8_t selected;
+   uint8_t cmd[6];
+   uint8_t cmdLen;
+   uint8_t idle;           //Until ACMD41
+   uint8_t appCmd;         //The last command was CMD55
+   uint8_t out[CARD_OUT_MAX];
+   uint16_t outLen;
+   uint16_t outPos;
+   uint32_t sectors;
+   uint32_t commands;
+   uint64_t bytes;         //Sector data sent
+};
+
+//Cycles of one kind of event
+struct timing {
+   uint32_t count;
+   uint64_t total;
+   uint32_t min;
+   uint32_t max;
+};
+
+struct sim_symbols {
+   uint32_t contextSwitch;
+   uint32_t contextSwitchSize;
+   uint32_t tickIsr;
+   uint32_t bootTimes;
+};
+
+struct block_device* image;
+struct card_model card;
+avr_irq_t* spiIn;
+
+void put(uint8_t b)
+{
+   card.out[card.outLen++] = b;
+}
+
+//Queues a data block: the access time, the start token, |len| bytes, a crc
+void putBlock(const uint8_t* data, uint16_t len)
+{
+   uint16_t i;
+
+   for(i = 0; i < accessBytes; i++)
+      put(0xFF);
+   put(DATA_START_BLOCK);
+   for(i = 0; i < len; i++)
+      put(data[i]);
+   put(0xFF);
+   put(0xFF);
+}
+
+//Queues the response to the command in card.cmd
+void cardCommand()
+{
+   uint8_t index = card.cmd[0] & 0x3F;
+   uint32_t arg = (uint32_t)card.cmd[1] << 24 | card.cmd[2] << 16
+      | card.cmd[3] << 8 | card.cmd[4];
+   uint8_t app = card.appCmd;
+   uint32_t cSize = card.sectors / 1024 - 1;
+   uint8_t reg[16];
+   uint8_t sector[BLOCKDEV_SECTOR_SIZE];
+
+   card.outLen = 0;
+   card.outPos = 0;
+   card.appCmd = 0;
+   card.commands++;
+   memset(reg, 0, sizeof(reg));
+
+   if(app && index == 41)
+   {
+      card.idle = 0;
+      put(0);
+      return;
+   }
+   switch(index)
+   {
+      case 0:
+         card.idle = 1;
+         put(R1_IDLE_STATE);
+         break;
+      case 8:
+         //Voltage accepted, check pattern echoed
+         put(card.idle);
+         put(0);
+         put(0);
+         put(arg >> 8 & 0x0F);
+         put(arg & 0xFF);
+         break;
+      case 9:
+         //CSD version 2, only the size matters
+         reg[0] = 0x40;
+         reg[5] = 0x09;
+         reg[7] = cSize >> 16 & 0x3F;
+         reg[8] = cSize >> 8;
+         reg[9] = cSize;
+         put(card.idle);
+         putBlock(reg, sizeof(reg));
+         break;
+      case 10:
+         reg[0] = 0x42;
+         memcpy(reg + 1, "SBSIMCD", 7);
+         reg[8] = 0x10;
+         reg[12] = 1;
+         reg[14] = 0x1A;
+         reg[15] = 0x01;
+         put(card.idle);
+         putBlock(reg, sizeof(reg));
+         break;
+      case 13:
+         put(card.idle);
+         put(0);
+         break;
+      case 17:
+         //SDHC, the argument is a sector number
+         if(arg >= card.sectors || !bdRead(image, arg, 0, sector, BLOCKDEV_SECTOR_SIZE))
+         {
+            put(card.idle | R1_ADDRESS_ERROR);
+            break;
+         }
+         put(card.idle);
+         putBlock(sector, BLOCKDEV_SECTOR_SIZE);
+         card.bytes += BLOCKDEV_SECTOR_SIZE;
+         break;
+      case 55:
+         card.appCmd = 1;
+         put(card.idle);
+         break;
+      case 58:
+         //Powered up, high capacity
+         put(card.idle);
+         put(0xC0);
+         put(0xFF);
+         put(0x80);
+         put(0x00);
+         break;
+      default:
+         put(card.idle | R1_ILLEGAL_COMMAND);
+         break;
+   }
+}
+
+//Returns what the card shifts out while |b| is shifted in
+uint8_t cardByte(uint8_t b)
+{
+   if(!card.selected)
+      return 0xFF;
+   //A command starts with 01, the host clocks 0xFF at every other time
+   if(card.cmdLen || (b & 0xC0) == 0x40)
+   {
+      card.cmd[card.cmdLen++] = b;
+      if(card.cmdLen == sizeof(card.cmd))
+      {
+         card.cmdLen = 0;
+         cardCommand();
+      }
+      return 0xFF;
+   }
+   if(card.outPos < card.outLen)
+      return card.out[card.outPos++];
+   return 0xFF;
+}
+
+//The master sent a byte, the answer becomes SPDR
+void spiOut(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+   avr_raise_irq(spiIn, cardByte(value));
+}
+
+void chipSelect(struct avr_irq_t* irq, uint32_t value, void* param)
+{
+   card.selected = !value;
+   card.cmdLen = 0;
+}
+
+void record(struct timing* t, uint32_t cycles)
+{
+   if(!t->count || cycles < t->min)
+      t->min = cycles;
+   if(cycles > t->max)
+      t->max = cycles;
+   t->count++;
+   t->total += cycles;
+}
+
+void report(const char* what, struct timing* t)
+{
+   printf("  %-16s %8u times %6u min %8.1f avg %6u max cycles\n", what, t->count,
+      t->min, t->count ? (double)t->total / t->count : 0.0, t->max);
+}
+
+//Reads the avr-nm -S output at |path|, 0 if a symbol is missing
+int readSymbols(const char* path, struct sim_symbols* sym)
+{
+   FILE* f = fopen(path, "r");
+   char line[256], name[200], type;
+   unsigned long addr, size;
+
+   if(!f)
+      return 0;
+   memset(sym, 0, sizeof(*sym));
+   while(fgets(line, sizeof(line), f))
+   {
+      if(sscanf(line, "%lx %lx %c %199s", &addr, &size, &type, name) != 4)
+      {
+         size = 0;
+         if(sscanf(line, "%lx %c %199s", &addr, &type, name) != 3)
+            continue;
+      }
+      if(!strcmp(name, "context_switch"))
+      {
+         sym->contextSwitch = addr;
+         sym->contextSwitchSize = size;
+      }
+      else if(!strcmp(name, "__vector_14"))     //TIMER0_COMPA, the tick
+         sym->tickIsr = addr;
+      else if(!strcmp(name, "bootTimes"))
+         sym->bootTimes = addr - SRAM_BASE;
+   }
+   fclose(f);
+   return sym->contextSwitch && sym->contextSwitchSize && sym->tickIsr && sym->bootTimes;
+}
+
+uint32_t readData32(avr_t* avr, uint32_t addr)
+{
+   return avr->data[addr] | avr->data[addr + 1] << 8
+      | avr->data[addr + 2] << 16 | (uint32_t)avr->data[addr + 3] << 24;
+}
+
+void usage(const char* name)
+{
+   fprintf(stderr, "usage: %s [-t seconds] [-a access_bytes] firmware.elf "
+      "firmware.sym image\n", name);
+   exit(2);
+}
+
+int main(int argc, char** argv)
+{
+   static const char* phaseNames[BOOT_PHASES] = {
+      "card", "mount", "start", "first sample", "indexed"
+   };
+   struct block_device host;
+   struct blockdev_geometry geo;
+   struct sim_symbols sym;
+   struct timing switches, ticks;
+   elf_firmware_t firmware;
+   avr_t* avr;
+   uint64_t phaseCycles[BOOT_PHASES];
+   uint64_t end, tickStart = 0, switchStart = 0, firstSampleBytes = 0;
+   uint32_t flags, pc, op;
+   double seconds = 5, sustained;
+   uint8_t inTick = 0, tickEnding, inSwitch = 0, phasesLeft = BOOT_PHASES;
+   int opt, state, i;
+
+   while((opt = getopt(argc, argv, "t:a:")) != -1)
+   {
+      switch(opt)
+      {
+         case 't': seconds = atof(optarg); break;
+         case 'a': accessBytes = strtoul(optarg, NULL, 0); break;
+         default: usage(argv[0]);
+      }
+   }
+   if(optind != argc - 3)
+      usage(argv[0]);
+
+   if(!readSymbols(argv[optind + 1], &sym))
+   {
+      fprintf(stderr, "%s: missing context_switch, __vector_14 or bootTimes\n",
+         argv[optind + 1]);
+      return 1;
+   }
+   image = hostDiskOpen(&host, argv[optind + 2]);
+   if(!image || !bdGeometry(image, &geo))
+   {
+      perror(argv[optind + 2]);
+      return 1;
+   }
+   card.sectors = geo.sectors;
+
+   memset(&firmware, 0, sizeof(firmware));
+   if(elf_read_firmware(argv[optind], &firmware))
+   {
+      fprintf(stderr, "%s: can't load\n", argv[optind]);
+      return 1;
+   }
+   strcpy(firmware.mmcu, MCU);
+   firmware.frequency = F_CPU;
+   avr = avr_make_mcu_by_name(MCU);
+   if(!avr)
+   {
+      fprintf(stderr, "simavr has no %s\n", MCU);
+      return 1;
+   }
+   avr_init(avr);
+   avr_load_firmware(avr, &firmware);
+
+   //The stats screen would only slow the run down
+   flags = 0;
+   avr_ioctl(avr, AVR_IOCTL_UART_GET_FLAGS('0'), &flags);
+   flags &= ~AVR_UART_FLAG_STDIO;
+   avr_ioctl(avr, AVR_IOCTL_UART_SET_FLAGS('0'), &flags);
+
+   spiIn = avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_INPUT);
+   avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_SPI_GETIRQ('0'), SPI_IRQ_OUTPUT),
+      spiOut, NULL);
+   avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), CS_PIN),
+      chipSelect, NULL);
+
+   memset(&switches, 0, sizeof(switches));
+   memset(&ticks, 0, sizeof(ticks));
+   memset(phaseCycles, 0, sizeof(phaseCycles));
+   end = (uint64_t)(seconds * F_CPU);
+
+   //One instruction at a time, so every entry and exit is seen
+   while(avr->cycle < end)
+   {
+      pc = avr->pc;
+      op = avr->flash[pc] | avr->flash[pc + 1] << 8;
+      if(pc == sym.tickIsr)
+      {
+         inTick = 1;
+         tickStart = avr->cycle;
+      }
+      tickEnding = inTick && op == OP_RETI;
+      if(pc == sym.contextSwitch)
+      {
+         inSwitch = 1;
+         switchStart = avr->cycle;
+      }
+
+      state = avr_run(avr);
+      if(state == cpu_Done || state == cpu_Crashed)
+      {
+         fprintf(stderr, "firmware stopped at pc %04x\n", avr->pc);
+         break;
+      }
+
+      if(tickEnding)
+      {
+         record(&ticks, avr->cycle - tickStart);
+         inTick = 0;
+      }
+      //A thread's first switch goes out through thread_start's sei, not a reti
+      else if(inTick && avr->sreg[S_I])
+         inTick = 0;
+      if(inSwitch && (avr->pc < sym.contextSwitch
+            || avr->pc >= sym.contextSwitch + sym.contextSwitchSize))
+      {
+         //An interrupt in the middle doesn't count
+         if(avr->pc >= VECTOR_BYTES)
+            record(&switches, avr->cycle - switchStart);
+         inSwitch = 0;
+      }
+
+      //main() stamps each phase once, with a nonzero time
+      for(i = 0; phasesLeft && i < BOOT_PHASES; i++)
+      {
+         if(phaseCycles[i] || !readData32(avr, sym.bootTimes + i * 4))
+            continue;
+         phaseCycles[i] = avr->cycle;
+         phasesLeft--;
+         if(i == BOOT_FIRST_SAMPLE)
+            firstSampleBytes = card.bytes;
+      }
+   }
+
+   printf("%s on %s, %u sectors, %.2f s simulated\n", argv[optind], argv[optind + 2],
+      card.sectors, (double)avr->cycle / F_CPU);
+   report("context switch", &switches);
+   report("tick isr", &ticks);
+   for(i = 0; i < BOOT_PHASES; i++)
+   {
+      if(phaseCycles[i])
+         printf("  boot %-12s %10.1f us\n", phaseNames[i], phaseCycles[i] * 1e6 / F_CPU);
+      else
+         printf("  boot %-12s %10s\n", phaseNames[i], "never");
+   }
+   printf("  card             %8u cmds %11llu bytes\n", card.commands,
+      (unsigned long long)card.bytes);
+   if(phaseCycles[BOOT_FIRST_SAMPLE] && avr->cycle > phaseCycles[BOOT_FIRST_SAMPLE])
+   {
+      sustained = (card.bytes - firstSampleBytes) * (double)F_CPU
+         / (avr->cycle - phaseCycles[BOOT_FIRST_SAMPLE]);
+      printf("  read path        %11.0f bytes/s after the first sample\n", sustained);
+   }
+   return 0;
+}
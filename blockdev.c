@@ -0,0 +1,75 @@
+#include <string.h>
+#include "blockdev.h"
+
+uint8_t ramDiskRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count);
+uint8_t ramDiskGeometry(struct block_device* dev, struct blockdev_geometry* geo);
+
+//Reads part of a sector from |dev|
+//Returns 1 on success and 0 on failure
+uint8_t bdRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count)
+{
+   if(offset + count > BLOCKDEV_SECTOR_SIZE)
+      return 0;
+   dev->stats.reads++;
+   dev->stats.bytes += count;
+   return dev->read(dev, sector, offset, dst, count);
+}
+
+//Reads |n| whole sectors starting at |sector|, one request at a time if the
+//backend has no multi-sector read
+uint8_t bdReadSectors(struct block_device* dev, uint32_t sector, uint8_t* dst,
+   uint16_t n)
+{
+   if(dev->readMulti)
+   {
+      dev->stats.reads++;
+      dev->stats.bytes += (uint32_t)n * BLOCKDEV_SECTOR_SIZE;
+      return dev->readMulti(dev, sector, dst, n);
+   }
+   for(; n; n--, sector++, dst += BLOCKDEV_SECTOR_SIZE)
+   {
+      if(!bdRead(dev, sector, 0, dst, BLOCKDEV_SECTOR_SIZE))
+         return 0;
+   }
+   return 1;
+}
+
+//Returns the size of |dev|
+uint8_t bdGeometry(struct block_device* dev, struct blockdev_geometry* geo)
+{
+   return dev->geometry(dev, geo);
+}
+
+//----------------------------RAM disk-------------------------------
+
+//Sets up |disk| to serve |sectors| sectors out of |data|
+struct block_device* ramDiskInit(struct ram_disk* disk, uint8_t* data,
+   uint32_t sectors)
+{
+   memset(disk, 0, sizeof(struct ram_disk));
+   disk->data = data;
+   disk->sectors = sectors;
+   disk->dev.read = ramDiskRead;
+   disk->dev.geometry = ramDiskGeometry;
+   return &disk->dev;
+}
+
+uint8_t ramDiskRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count)
+{
+   struct ram_disk* disk = (struct ram_disk*)dev;
+   if(sector >= disk->sectors)
+      return 0;
+   memcpy(dst, disk->data + sector * BLOCKDEV_SECTOR_SIZE + offset, count);
+   return 1;
+}
+
+uint8_t ramDiskGeometry(struct block_device* dev, struct blockdev_geometry* geo)
+{
+   struct ram_disk* disk = (struct ram_disk*)dev;
+   geo->sectors = disk->sectors;
+   geo->sectorSize = BLOCKDEV_SECTOR_SIZE;
+   return 1;
+}
@@ -0,0 +1,53 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+#include <stdint.h>
+
+#define BLOCKDEV_SECTOR_SIZE 512
+
+struct blockdev_geometry {
+   uint32_t sectors;       //Number of sectors on the device
+   uint16_t sectorSize;    //Bytes per sector
+};
+
+struct blockdev_stats {
+   uint32_t reads;         //Read requests passed to the backend
+   uint32_t bytes;         //Bytes returned by the backend
+};
+
+//A sector addressed, read only storage device
+struct block_device {
+   //Reads |count| bytes at |offset| inside |sector|, required
+   uint8_t (*read)(struct block_device* dev, uint32_t sector, uint16_t offset,
+      uint8_t* dst, uint16_t count);
+   //Reads |n| consecutive whole sectors, optional
+   uint8_t (*readMulti)(struct block_device* dev, uint32_t sector, uint8_t* dst,
+      uint16_t n);
+   //Fills in the size of the device
+   uint8_t (*geometry)(struct block_device* dev, struct blockdev_geometry* geo);
+   void* priv;
+   struct blockdev_stats stats;
+};
+
+uint8_t bdRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count);
+uint8_t bdReadSectors(struct block_device* dev, uint32_t sector, uint8_t* dst,
+   uint16_t n);
+uint8_t bdGeometry(struct block_device* dev, struct blockdev_geometry* geo);
+
+//Sectors held in memory
+struct ram_disk {
+   struct block_device dev;
+   uint8_t* data;
+   uint32_t sectors;
+};
+
+//Backends
+struct block_device* sdDevice();
+struct block_device* ramDiskInit(struct ram_disk* disk, uint8_t* data,
+   uint32_t sectors);
+#ifndef __AVR__
+struct block_device* hostDiskOpen(struct block_device* dev, const char* path);
+void hostDiskClose(struct block_device* dev);
+#endif
+
+#endif
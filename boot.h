@@ -0,0 +1,15 @@
+#ifndef BOOT_H
+#define BOOT_H
+
+//Points in the boot timed by boot_mark() in main.c, each one's tick count is
+//kept in bootTimes[] where bench/simbench.c reads them by these indices
+enum boot_phase {
+   BOOT_CARD,          //Card out of idle and at full SPI speed
+   BOOT_MOUNT,         //Filesystem mounted by the loader, playlist index checked
+   BOOT_START,         //Threads about to start
+   BOOT_FIRST_SAMPLE,  //First block of song 0 reached the player
+   BOOT_INDEXED,       //Library counted once the ring first filled
+   BOOT_PHASES
+};
+
+#endif
@@ -0,0 +1,24 @@
+#include "crc.h"
+#ifdef __AVR__
+#include <util/crc16.h>
+#endif
+
+//Returns |crc| updated with |len| bytes at |data|, CRC-CCITT as avr-libc computes it
+uint16_t crcCcitt(uint16_t crc, const void* data, uint16_t len)
+{
+    const uint8_t* p = data;
+#ifdef __AVR__
+    while(len--)
+        crc = _crc_ccitt_update(crc, *p++);
+#else
+    uint8_t b;
+    while(len--)
+    {
+        //The C equivalent from the avr-libc documentation
+        b = *p++ ^ (crc & 0xFF);
+        b ^= b << 4;
+        crc = (((uint16_t)b << 8) | (crc >> 8)) ^ (uint8_t)(b >> 4) ^ ((uint16_t)b << 3);
+    }
+#endif
+    return crc;
+}
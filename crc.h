@@ -0,0 +1,8 @@
+#ifndef CRC_H
+#define CRC_H
+#include <stdint.h>
+
+//Shared by the playlist index and the telemetry frames, start from 0xFFFF
+uint16_t crcCcitt(uint16_t crc, const void* data, uint16_t len);
+
+#endif
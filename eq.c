@@ -0,0 +1,189 @@
+#include <math.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include "eq.h"
+#include "os.h"
+
+#define EQ_BENCH_SAMPLES 64
+//Corners above this fraction of the sample rate are left out
+#define EQ_MAX_CORNER 0.45
+
+enum biquad_type {
+   BIQUAD_NONE,
+   BIQUAD_LOWPASS,
+   BIQUAD_HIGHPASS
+};
+
+struct biquad_spec {
+   uint8_t type;
+   uint16_t freq;
+   uint8_t q;              //Hundredths
+};
+
+const struct biquad_spec eqPresets[EQ_PRESETS][EQ_SECTIONS] PROGMEM = {
+   [EQ_FLAT] =   {{BIQUAD_NONE, 0, 0},        {BIQUAD_NONE, 0, 0}},
+   [EQ_SMOOTH] = {{BIQUAD_LOWPASS, 5000, 71}, {BIQUAD_NONE, 0, 0}},
+   [EQ_WARM] =   {{BIQUAD_LOWPASS, 3000, 54}, {BIQUAD_LOWPASS, 3000, 131}},
+   [EQ_VOICE] =  {{BIQUAD_HIGHPASS, 300, 71}, {BIQUAD_LOWPASS, 3400, 71}},
+};
+
+struct biquad eqSections[EQ_SECTIONS];
+uint8_t eqActive = 0;
+
+void biquadDesign(struct biquad* q, const struct biquad_spec* spec, uint16_t rate);
+
+//Returns |acc| plus |a| times |b|
+//The AVR path is the signed 16x16 multiply-accumulate from Atmel's AVR201
+//note, four hardware multiplies where libgcc would widen to 32x32
+static inline int32_t eqMac(int32_t acc, int16_t a, int16_t b)
+{
+#ifdef __AVR__
+   uint8_t zero = 0;
+   asm("muls %B1, %B2"     "\n\t"
+       "add %C0, r0"       "\n\t"
+       "adc %D0, r1"       "\n\t"
+       "mul %A1, %A2"      "\n\t"
+       "add %A0, r0"       "\n\t"
+       "adc %B0, r1"       "\n\t"
+       "adc %C0, %3"       "\n\t"
+       "adc %D0, %3"       "\n\t"
+       "mulsu %B1, %A2"    "\n\t"
+       "sbc %D0, %3"       "\n\t"
+       "add %B0, r0"       "\n\t"
+       "adc %C0, r1"       "\n\t"
+       "adc %D0, %3"       "\n\t"
+       "mulsu %B2, %A1"    "\n\t"
+       "sbc %D0, %3"       "\n\t"
+       "add %B0, r0"       "\n\t"
+       "adc %C0, r1"       "\n\t"
+       "adc %D0, %3"       "\n\t"
+       "clr __zero_reg__"
+       : "+r" (acc)
+       : "a" (a), "a" (b), "r" (zero));
+   return acc;
+#else
+   return acc + (int32_t)a * b;
+#endif
+}
+
+//Runs |x| through section |q| and returns its output, clipped to 16 bits
+static inline int16_t biquadRun(struct biquad* q, int16_t x)
+{
+   //Starting at one half rounds the result
+   int32_t acc = (int32_t)1 << (EQ_COEF_SHIFT - 1);
+   int16_t y;
+
+   acc = eqMac(acc, q->b0, x);
+   acc = eqMac(acc, q->b1, q->x1);
+   acc = eqMac(acc, q->b2, q->x2);
+   acc = eqMac(acc, q->a1, q->y1);
+   acc = eqMac(acc, q->a2, q->y2);
+
+   if(acc >= (int32_t)0x20000000)
+      y = 0x7FFF;
+   else if(acc < -(int32_t)0x20000000)
+      y = -0x8000;
+   else
+      //Shifting left and taking the top half is bytes moves, not 14 shifts
+      y = (int16_t)(((uint32_t)acc << (16 - EQ_COEF_SHIFT)) >> 16);
+
+   q->x2 = q->x1;
+   q->x1 = x;
+   q->y2 = q->y1;
+   q->y1 = y;
+   return y;
+}
+
+//Sets up the sections of |preset| for songs at |rate| and clears their history
+//Works the coefficients out in floating point, only call it when something changes
+void eqSetPreset(uint8_t preset, uint16_t rate)
+{
+   const struct biquad_spec* specs = eqPresets[preset < EQ_PRESETS ? preset : EQ_FLAT];
+   struct biquad_spec spec;
+   uint8_t i;
+
+   eqActive = 0;
+   for(i = 0; i < EQ_SECTIONS; i++)
+   {
+      //The presets live in flash
+      memcpy_P(&spec, &specs[i], sizeof(spec));
+      if(spec.type == BIQUAD_NONE || spec.freq >= rate * EQ_MAX_CORNER)
+         continue;
+      biquadDesign(&eqSections[eqActive++], &spec, rate);
+   }
+}
+
+//Filters |len| unsigned 8-bit samples in |data| in place
+void eqProcess(uint8_t* data, uint16_t len)
+{
+   uint8_t i;
+   int16_t x;
+
+   if(!eqActive)
+      return;
+   for(; len; len--, data++)
+   {
+      x = (int16_t)(int8_t)(*data ^ 0x80) << EQ_SAMPLE_SHIFT;
+      for(i = 0; i < eqActive; i++)
+         x = biquadRun(&eqSections[i], x);
+      //Round back to 8 bits without overflowing near the top
+      x = ((x >> (EQ_SAMPLE_SHIFT - 1)) + 1) >> 1;
+      if(x > 127)
+         x = 127;
+      else if(x < -128)
+         x = -128;
+      *data = (uint8_t)x ^ 0x80;
+   }
+}
+
+//Returns how many cycles one section takes per sample
+uint16_t eqBenchmark()
+{
+   const struct biquad_spec spec = {BIQUAD_LOWPASS, 1000, 71};
+   struct biquad q;
+   uint16_t stamp;
+   uint32_t cycles;
+   uint8_t sreg, i;
+   int16_t x = 0;
+
+   biquadDesign(&q, &spec, TICK_HZ);
+
+   sreg = SREG;
+   cli();
+   stamp = cycle_stamp();
+   for(i = 0; i < EQ_BENCH_SAMPLES; i++)
+      x = biquadRun(&q, x + (i << 8));
+   cycles = cycles_since(stamp);
+   SREG = sreg;
+   return cycles / EQ_BENCH_SAMPLES;
+}
+
+//Returns |v| as a Q14 coefficient, clipped to what fits
+static int16_t eqCoef(float v)
+{
+   v *= (float)((int32_t)1 << EQ_COEF_SHIFT);
+   if(v > 32767.0)
+      return 32767;
+   if(v < -32768.0)
+      return -32768;
+   return (int16_t)lroundf(v);
+}
+
+//Works out the coefficients of |spec| at |rate| from the RBJ cookbook formulas
+void biquadDesign(struct biquad* q, const struct biquad_spec* spec, uint16_t rate)
+{
+   float w0 = 2 * M_PI * spec->freq / rate;
+   float cosw = cosf(w0);
+   float alpha = sinf(w0) * 50 / spec->q;   //sin(w0) / (2 Q)
+   float a0 = 1 + alpha;
+   float b1 = spec->type == BIQUAD_LOWPASS ? 1 - cosw : -(1 + cosw);
+
+   memset(q, 0, sizeof(struct biquad));
+   q->b0 = eqCoef(fabsf(b1) / 2 / a0);
+   q->b1 = eqCoef(b1 / a0);
+   q->b2 = q->b0;
+   q->a1 = eqCoef(2 * cosw / a0);
+   q->a2 = eqCoef(-(1 - alpha) / a0);
+}
@@ -0,0 +1,29 @@
+#ifndef EQ_H
+#define EQ_H
+#include <stdint.h>
+
+//Biquad sections a preset can cascade
+#define EQ_SECTIONS 2
+//Coefficients are Q14, samples carry 6 fractional bits below the 8-bit output
+#define EQ_COEF_SHIFT 14
+#define EQ_SAMPLE_SHIFT 6
+
+enum eq_preset {
+   EQ_FLAT,        //No filtering
+   EQ_SMOOTH,      //2nd order low-pass at 5 kHz, takes the edge off
+   EQ_WARM,        //4th order Butterworth low-pass at 3 kHz
+   EQ_VOICE,       //300 Hz to 3.4 kHz band for speech
+   EQ_PRESETS
+};
+
+//One second order section, a1 and a2 are stored negated so every term adds
+struct biquad {
+   int16_t b0, b1, b2, a1, a2;
+   int16_t x1, x2, y1, y2;
+};
+
+void eqSetPreset(uint8_t preset, uint16_t rate);
+void eqProcess(uint8_t* data, uint16_t len);
+uint16_t eqBenchmark();
+
+#endif
@@ -1,25 +1,42 @@
 #include <stdio.h>
-#include <avr/io.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include "ext.h"
-#include "SdReader.h"
+#include "blockdev.h"
+#include "crc.h"
 
 #define DIRECT_BLOCKS 12
-#define INDIRECT_BLOCKS 256
-#define DOUBLE_INDIRECT_BLOCKS 65536
 #define DIR_READ_SIZE 100
 #define ROOT_INODE 2
-#define BLOCK_SIZE 1024
+#define SUPER_BLOCK_OFFSET 1024
+#define MAX_LOG_BLOCK_SIZE 2 //4096 byte blocks
 #define SECTOR_SIZE 512
-#define BUFFER_SIZE 256
 #define INODE_TYPE_DIR 0x4000
 #define INODE_TYPE_FILE 0x8000
-#define NUM_SONGS 13
-#define BLOCKS_PER_GROUP 8192
-#define INODES_PER_GROUP 7696
-#define INODE_TABLE_OFFSET 5
-#define MAX_NAME_LEN 75
+
+//Device the filesystem lives on and its geometry, filled in by extMount()
+struct block_device* extDev;
+uint16_t blockSize;
+uint16_t ptrsPerBlock;
+uint32_t inodesPerGroup;
+uint16_t inodeSize;
+uint32_t groupDescBlock;
+//Metadata kept from the card so opening and streaming a song don't read it again
+uint32_t rootBlock;         //First block of the root directory, where all the songs are
+uint32_t tableGroup;        //Block group whose inode table starts at tableBlock
+uint32_t tableBlock;
+//The last block map lookup, so reads inside the same block skip the indirect
+//pointers, the loader only streams one file at a time
+struct ext_file* mapFile;
+uint32_t mapFileBlock;
+uint32_t mapBlock;
+//Songs in the root directory, and the playlist index when it is current
+uint16_t songCount;
+uint32_t indexInode;
+uint8_t indexValid;
+//Names are cut to MAX_NAME_LEN when they come from an index entry
+typedef char nameFitsIndex[MAX_NAME_LEN <= EXT_INDEX_NAME_LEN ? 1 : -1];
 
 //Public Functions
 void getSongName(uint16_t index, char buffer[MAX_NAME_LEN]);
@@ -28,148 +45,370 @@ struct ext2_dir_entry searchRoot(uint16_t index, char buffer[MAX_NAME_LEN]);
 //Directory 
 struct ext2_dir_entry directoryEntry(uint32_t blockIndex,uint16_t index, char buffer[MAX_NAME_LEN]);
 //General
+uint8_t extRead(uint32_t index, void* dst, uint16_t count);
 void indexToBlock(uint32_t index, uint32_t* block, uint16_t* offset);
 struct ext2_inode getInode(int inodeNum);
-uint32_t getSongStart(uint16_t songIndex);
+uint8_t inodeToBlock(int inodeNum, uint32_t* block, uint16_t* offset);
+uint32_t inodeDataBlock(uint32_t* blocks, uint32_t fileBlock);
+uint16_t scanRoot(const char* name, uint32_t* inodeNum);
+uint8_t isSongEntry(uint16_t position, struct ext2_dir_entry* entry);
+uint8_t inodeRead(uint32_t inodeNum, uint16_t offset, void* dst, uint16_t count);
+uint32_t fileDataBlock(struct ext_file* file, uint32_t fileBlock);
+uint8_t indexRead(uint32_t pos, void* dst, uint16_t count);
+uint8_t indexEntry(uint16_t songIndex, struct ext_index_entry* entry);
+__attribute__((noinline)) uint8_t readSuper();
 
 
 //------------------------Public Functions--------------------------
 
+//Reads the super block from |dev| and sets up the filesystem geometry
+//Returns 1 on success, 0 if |dev| doesn't hold a supported ext2 filesystem
+uint8_t extMount(struct block_device* dev)
+{
+    extDev = dev;
+    tableGroup = 0xFFFFFFFF;
+    mapFile = NULL;
+    if(!readSuper()
+        || !inodeRead(ROOT_INODE, offsetof(struct ext2_inode, i_block), &rootBlock, 4))
+        return 0;
+    extIndexLoad();
+    return 1;
+}
+
+//Sets up the geometry from the super block
+//Kept out of extMount() so the super block is off the stack before the index is read
+//Returns 1 on success, 0 if it isn't a supported ext2 super block
+__attribute__((noinline)) uint8_t readSuper()
+{
+    struct ext2_super_block super;
+
+    if(!extRead(SUPER_BLOCK_OFFSET, &super, sizeof(struct ext2_super_block)))
+        return 0;
+    if(super.s_magic != EXT2_SUPER_MAGIC || super.s_log_block_size > MAX_LOG_BLOCK_SIZE
+        || !super.s_inodes_per_group)
+        return 0;
+
+    blockSize = 1024 << super.s_log_block_size;
+    ptrsPerBlock = blockSize / 4;
+    inodesPerGroup = super.s_inodes_per_group;
+    inodeSize = super.s_rev_level == EXT2_GOOD_OLD_REV ?
+        EXT2_GOOD_OLD_INODE_SIZE : super.s_inode_size;
+    if(inodeSize < EXT2_GOOD_OLD_INODE_SIZE)
+        return 0;
+    //Group descriptors start in the block after the super block
+    groupDescBlock = super.s_first_data_block + 1;
+    return 1;
+}
+
+//Looks for a current playlist index in the root directory
+//Without one the song count stays 0 until extCountSongs() walks the directory
+//Returns 1 if the index is used
+uint8_t extIndexLoad()
+{
+    struct ext_index_header header;
+    uint32_t dirMtime;
+
+    indexValid = 0;
+    //The index is only written in place, so the directory is untouched
+    //since it was made exactly when the root mtime still matches
+    //It is found by name, made before the songs it is among the first entries
+    if(extFindRoot(EXT_INDEX_NAME, &indexInode)
+        && indexRead(0, &header, sizeof(struct ext_index_header))
+        && header.magic == EXT_INDEX_MAGIC
+        && header.version == EXT_INDEX_VERSION
+        && header.entrySize == sizeof(struct ext_index_entry)
+        && header.crc == crcCcitt(0xFFFF, &header, offsetof(struct ext_index_header, crc))
+        && inodeRead(ROOT_INODE, offsetof(struct ext2_inode, i_mtime), &dirMtime, 4)
+        && dirMtime == header.dirMtime)
+    {
+        indexValid = 1;
+        songCount = header.count;
+        return 1;
+    }
+    songCount = 0;
+    return 0;
+}
+
+//Counts the songs by walking the root directory, even when there is an index
+//The count is only used when there is no index, walking it can wait until
+//the first song is playing
+uint16_t extCountSongs()
+{
+    uint16_t songs = scanRoot(NULL, NULL);
+    if(!indexValid)
+        songCount = songs;
+    return songs;
+}
+
+//Returns 1 when songs are being opened from the playlist index
+uint8_t extIndexed()
+{
+    return indexValid;
+}
+
+//Returns the number of songs in the root directory, 0 until they are counted
+uint16_t extSongCount()
+{
+    return songCount;
+}
+
 //Returns the name of the song at |index|
 //Variable size depending on entryName
 void getSongName(uint16_t index, char buffer[MAX_NAME_LEN])
 {
-    struct ext2_dir_entry dirEntry = searchRoot(index, buffer);
-    return;
+    struct ext_index_entry entry;
+
+    if(indexEntry(index, &entry))
+    {
+        memcpy(buffer, entry.name, MAX_NAME_LEN - 1);
+        buffer[MAX_NAME_LEN - 1] = '\0';
+        return;
+    }
+    searchRoot(index, buffer);
 }
 
-//Given a song index, a buffer, and the number of times this function has been called
-//On this song, fills the buffer with the next 256 bytes
-//Returns the number of calls needed to get the full song
-uint32_t fillBuffer(uint16_t songIndex, uint8_t buffer[BUFFER_SIZE], uint32_t callCount)
+//Looks up the song at |songIndex| once so it can be read with extReadFile()
+//Copies its name into |name| unless it is NULL
+//Returns 1 on success, 0 if there is no such file
+uint8_t extOpen(uint16_t songIndex, struct ext_file* file, char name[MAX_NAME_LEN])
 {
-    uint32_t inodeNum = getSongStart(songIndex);
-    uint32_t indirect, doubleIndirect;
-    //Amount of data we've read from this file so far
-    uint32_t readData = callCount * BUFFER_SIZE;
-    //Determine which inode block we're in
-    uint16_t inodeBlock = readData / BLOCK_SIZE;
-    //And the offset within that block
-    uint16_t inodeOffset;
-    struct ext2_inode inode = getInode(inodeNum);
+    return extOpenInode(searchRoot(songIndex, name).inode, file);
+}
 
-    uint32_t block;
-    uint16_t offset;
-    if(inodeBlock < DIRECT_BLOCKS)
+//Opens the file at |inodeNum| for extReadFile()
+//Returns 0 for inode 0
+uint8_t extOpenInode(uint32_t inodeNum, struct ext_file* file)
+{
+    if(!inodeNum)
+        return 0;
+    if(mapFile == file)
+        mapFile = NULL;
+    file->extents = 0;
+    return inodeRead(inodeNum, offsetof(struct ext2_inode, i_size), &file->size, 4)
+        && inodeRead(inodeNum, offsetof(struct ext2_inode, i_block), file->map.block,
+            sizeof(file->map.block));
+}
+
+//Opens the song at |songIndex| from the playlist index, with no directory
+//walk and the sample data already located in |audio|
+//Copies its name into |name| unless it is NULL
+//Returns 0 if there is no current index or the song changed since it was
+//made, the caller should fall back to extOpen() and wavOpen()
+uint8_t extOpenIndexed(uint16_t songIndex, struct ext_file* file, char name[MAX_NAME_LEN],
+    struct ext_index_audio* audio)
+{
+    struct ext_index_entry entry;
+    uint32_t now[5];    //i_size, i_atime, i_ctime, i_mtime, i_dtime
+
+    if(!indexEntry(songIndex, &entry))
+        return 0;
+    //A song rewritten in place leaves the directory alone, so check its own inode
+    if(!inodeRead(entry.inode, offsetof(struct ext2_inode, i_size), now, sizeof(now))
+        || now[0] != entry.size || now[3] != entry.mtime || now[4])
+        return 0;
+
+    if(mapFile == file)
+        mapFile = NULL;
+    file->size = entry.size;
+    file->extents = entry.extents;
+    if(entry.extents)
     {
-        inodeOffset = readData % BLOCK_SIZE;
-        indexToBlock((BLOCK_SIZE * inode.i_block[inodeBlock]) + inodeOffset, &block, &offset);
+        memcpy(file->map.run.start, entry.extentStart, sizeof(file->map.run.start));
+        memcpy(file->map.run.len, entry.extentLen, sizeof(file->map.run.len));
     }
-    else if(inodeBlock < DIRECT_BLOCKS + INDIRECT_BLOCKS)
-    {
-        //How far into the indirect block we need to look, 4 byte pointers
-        inodeOffset = (inodeBlock - DIRECT_BLOCKS) * 4;
+    else if(!inodeRead(entry.inode, offsetof(struct ext2_inode, i_block), file->map.block,
+            sizeof(file->map.block)))
+        return 0;
 
-        //Indirect is block 12
-        indexToBlock((BLOCK_SIZE * inode.i_block[12]) + inodeOffset, &block, &offset);
-        //Get the pointer to the portion of the indirect block we care about
-        sdReadData(block, offset, &indirect, 4);
-        //Reset the offset to how far into the indirect block we should look
-        inodeOffset = readData % BLOCK_SIZE;
-        //Set up block and offset for the indirect block
-        indexToBlock((BLOCK_SIZE * indirect) + inodeOffset, &block, &offset);
-    }
-    else
+    if(name)
     {
-        //How far into the double indirect block we need to look
-        inodeOffset = ((inodeBlock - (DIRECT_BLOCKS + INDIRECT_BLOCKS)) / INDIRECT_BLOCKS) * 4;
-
-        //Get the pointer to the portion of the double indirect block we care about
-        indexToBlock((BLOCK_SIZE * inode.i_block[13]) + inodeOffset, &block, &offset);
-        sdReadData(block, offset, &doubleIndirect, 4);
-
-        //How far into the indirect block we need to look
-        inodeOffset = ((inodeBlock - (DIRECT_BLOCKS + INDIRECT_BLOCKS)) % INDIRECT_BLOCKS) * 4;
+        memcpy(name, entry.name, MAX_NAME_LEN - 1);
+        name[MAX_NAME_LEN - 1] = '\0';
+    }
+    memcpy(audio, &entry.audio, sizeof(struct ext_index_audio));
+    return 1;
+}
 
-        //Get the pointer to the portion of the indirect block we care about
-        indexToBlock((BLOCK_SIZE * doubleIndirect) + inodeOffset, &block, &offset);
-        sdReadData(block, offset, &indirect, 4);
+//Reads up to |count| bytes at |pos| in |file|, stopping at the end of the file
+//or at a block that can't be found or read
+//Returns the number of bytes read
+uint16_t extReadFile(struct ext_file* file, uint32_t pos, uint8_t* dst, uint16_t count)
+{
+    uint16_t done = 0;
+    uint16_t inBlock, part;
+    uint32_t block;
 
-        //Reset the offset to how far into the indirect block we should look
-        inodeOffset = readData % BLOCK_SIZE;
+    if(pos >= file->size)
+        return 0;
+    if(count > file->size - pos)
+        count = file->size - pos;
 
-        //Set up block and offset for the indirect block
-        indexToBlock((BLOCK_SIZE * indirect) + inodeOffset, &block, &offset);
+    while(done < count)
+    {
+        inBlock = pos % blockSize;
+        part = blockSize - inBlock;
+        if(part > count - done)
+            part = count - done;
+        block = fileDataBlock(file, pos / blockSize);
+        if(!block || !extRead(((uint32_t)blockSize * block) + inBlock, dst + done, part))
+            break;
+        done += part;
+        pos += part;
     }
-    sdReadData(block, offset, buffer, BUFFER_SIZE);
+    return done;
+}
+
+//Returns the sector holding byte |pos| of |file|, 0 if its block can't be found
+uint32_t extFileSector(struct ext_file* file, uint32_t pos)
+{
+    uint32_t block = fileDataBlock(file, pos / blockSize);
 
-    indirect = inode.i_size - (readData + BUFFER_SIZE);
-    return indirect;
+    if(!block)
+        return 0;
+    return (((uint32_t)blockSize * block) + pos % blockSize) / SECTOR_SIZE;
 }
 
 //------------------------------Search--------------------------------
 
 //Returns the directory entry of the file at |index| in the root directory
-//128 + 32 + 16 + 16
-//24 bytes
+//Only need to go to the 1st block, all songs fit there
 struct ext2_dir_entry searchRoot(uint16_t index, char buffer[MAX_NAME_LEN])
 {
-    //Only need to go to the 1st block, all songs fit there
-    return directoryEntry(getInode(ROOT_INODE).i_block[0], index, buffer);
+    return directoryEntry(rootBlock, index, buffer);
 }
 
 //----------------------------Directory-------------------------------
 
 //Returns the |index|th directory entry from the directory at |blockIndex|
+//Copies the entry name into |buffer| unless it is NULL
 //32 + 16 + 16 + 16 + 16 + 32 + 16 + 16 + 8*(100) + 8 + (64 + 8*len)
 struct ext2_dir_entry directoryEntry(uint32_t blockIndex,uint16_t index, char buffer[MAX_NAME_LEN])
 {
     uint16_t readData = 0;
     uint16_t currentIndex = 0;
-    uint32_t block;
-    uint16_t offset;
-    uint16_t entrySize;
+    uint16_t nameLen;
     uint8_t data[DIR_READ_SIZE];
     struct ext2_dir_entry* directory;
     struct ext2_dir_entry dirReturn;
-    index += 3; //Account for . .. and lost+found entries
-    //Get directory entry
-    indexToBlock(BLOCK_SIZE * blockIndex, &block, &offset);
-    sdReadData(block, offset, data, DIR_READ_SIZE);
+    uint16_t position = 0;
+    uint8_t found = 0;
 
+    //Data to read can stradle a sector, extRead splits it
+    //A failed read ends the walk, the songs after it can't be found
     directory = (struct ext2_dir_entry*)data;
-    while(readData < BLOCK_SIZE)
+    while(readData < blockSize
+        && extRead(((uint32_t)blockSize * blockIndex) + readData, data, DIR_READ_SIZE))
     {
-        if(currentIndex == index)
-            break;
-        
-        readData += directory->rec_len;
-
-        indexToBlock((BLOCK_SIZE * blockIndex) + readData, &block, &offset);
-        //Data to read can stradle a sector
-        if(offset + DIR_READ_SIZE > SECTOR_SIZE)
+        //Only songs count towards |index|
+        if(isSongEntry(position++, directory))
         {
-            entrySize = directory->rec_len;
-             //Get the portion in this sector
-            sdReadData(block, offset, data, DIR_READ_SIZE - offset);
-            //Get the remaining portion
-            sdReadData(block + 1, 0, data + DIR_READ_SIZE - offset, 
-                    entrySize - (DIR_READ_SIZE - offset));
+            if(currentIndex == index)
+            {
+                found = 1;
+                break;
+            }
+            currentIndex++;
         }
-        else
-            sdReadData(block, offset, data, DIR_READ_SIZE);
+        if(!directory->rec_len)
+            break;
 
-        directory = (struct ext2_dir_entry*)data;
-        currentIndex++;
+        readData += directory->rec_len;
     }
     memcpy(&dirReturn, directory, sizeof(struct ext2_dir_entry));
-    memcpy(buffer, directory->name, dirReturn.name_len + 1);
-    buffer[dirReturn.name_len] = "\0";
+    //Past the last song, nothing to open
+    if(!found)
+    {
+        dirReturn.inode = 0;
+        dirReturn.name_len = 0;
+    }
+    if(buffer)
+    {
+        //Low byte only, the high byte is the file type on newer filesystems
+        nameLen = dirReturn.name_len & 0xFF;
+        if(nameLen > MAX_NAME_LEN - 1)
+            nameLen = MAX_NAME_LEN - 1;
+        memcpy(buffer, directory->name, nameLen);
+        buffer[nameLen] = '\0';
+    }
     return dirReturn;
 }
 
+//Walks the first block of the root directory, where all the songs are
+//Stops at the entry called |name| and stores its inode in |inodeNum| unless |name| is NULL
+//Returns the number of songs passed
+uint16_t scanRoot(const char* name, uint32_t* inodeNum)
+{
+    uint32_t start = (uint32_t)blockSize * rootBlock;
+    uint16_t readData = 0;
+    uint16_t position = 0;
+    uint16_t songs = 0;
+    uint16_t nameLen = name ? strlen(name) : 0;
+    uint8_t data[DIR_READ_SIZE];
+    struct ext2_dir_entry* directory = (struct ext2_dir_entry*)data;
+
+    if(inodeNum)
+        *inodeNum = 0;
+    while(readData < blockSize)
+    {
+        if(!extRead(start + readData, data, DIR_READ_SIZE) || !directory->rec_len)
+            break;
+        if(name && directory->inode && (directory->name_len & 0xFF) == nameLen
+            && !memcmp(directory->name, name, nameLen))
+        {
+            *inodeNum = directory->inode;
+            break;
+        }
+        if(isSongEntry(position++, directory))
+            songs++;
+        readData += directory->rec_len;
+    }
+    return songs;
+}
+
+//Finds the file called |name| in the root directory and stores its inode in |inodeNum|
+//Returns 1 if it is there
+uint8_t extFindRoot(const char* name, uint32_t* inodeNum)
+{
+    scanRoot(name, inodeNum);
+    return *inodeNum != 0;
+}
+
+//Returns 1 if |entry|, the |position|th in the root directory, is a song
+//The first three are . .. and lost+found, deleted entries and the index are skipped
+uint8_t isSongEntry(uint16_t position, struct ext2_dir_entry* entry)
+{
+    uint16_t nameLen = entry->name_len & 0xFF;
+
+    if(position < 3 || !entry->inode)
+        return 0;
+    return nameLen != sizeof(EXT_INDEX_NAME) - 1 || memcmp(entry->name, EXT_INDEX_NAME, nameLen);
+}
+
 //------------------------------General-------------------------------
 
+//Reads |count| bytes at the raw byte |index| on the device, across sectors if needed
+//Returns 1 on success and 0 on failure
+uint8_t extRead(uint32_t index, void* dst, uint16_t count)
+{
+    uint32_t block;
+    uint16_t offset;
+    uint16_t part;
+
+    while(count)
+    {
+        indexToBlock(index, &block, &offset);
+        part = SECTOR_SIZE - offset;
+        if(part > count)
+            part = count;
+        if(!bdRead(extDev, block, offset, dst, part))
+            return 0;
+        index += part;
+        dst = (uint8_t*)dst + part;
+        count -= part;
+    }
+    return 1;
+}
+
 //Given a raw index to the file, converts it to block and offset needed for read_data
 void indexToBlock(uint32_t index, uint32_t* block, uint16_t* offset)
 {
@@ -179,29 +418,206 @@ void indexToBlock(uint32_t index, uint32_t* block, uint16_t* offset)
     return;
 }
 
-uint32_t getSongStart(uint16_t songIndex)
-{
-    char fakebuf[2];
-    return searchRoot(songIndex, fakebuf).inode;
-}
-
-//Mallocs and returns a pointer to the inode at |inodeNum|
+//Returns the inode at |inodeNum|, all zero if it can't be read
 struct ext2_inode getInode(int inodeNum)
 {
     struct ext2_inode inode;
-    int blockGroup = (inodeNum - 1) / INODES_PER_GROUP;
-    int localIndex = (inodeNum - 1) % INODES_PER_GROUP;
     uint32_t block;
     uint16_t offset;
-    
-    //raw index to seek within the file, first get to the right block, 
-    //then go to that block groups inode table, and index inside
-    uint32_t fileIndex = ((uint32_t)BLOCK_SIZE * ((blockGroup * BLOCKS_PER_GROUP) + INODE_TABLE_OFFSET))
-     + (localIndex * sizeof(struct ext2_inode));
 
-    //Convert raw index into block and offset
-    indexToBlock(fileIndex, &block, &offset);
-
-    sdReadData(block, offset, &inode, sizeof(struct ext2_inode));
+    if(!inodeToBlock(inodeNum, &block, &offset)
+        || !bdRead(extDev, block, offset, (uint8_t*)&inode, sizeof(struct ext2_inode)))
+        memset(&inode, 0, sizeof(struct ext2_inode));
     return inode;
-}
\ No newline at end of file
+}
+
+//Finds the sector and offset holding the inode at |inodeNum|
+//Returns 0 if its group descriptor can't be read
+uint8_t inodeToBlock(int inodeNum, uint32_t* block, uint16_t* offset)
+{
+    uint32_t blockGroup = (inodeNum - 1) / inodesPerGroup;
+    uint32_t localIndex = (inodeNum - 1) % inodesPerGroup;
+    uint32_t inodeTable;
+
+    //Look up the block groups inode table in its group descriptor, unless it
+    //is the group looked up last time
+    if(blockGroup != tableGroup)
+    {
+        if(!extRead(((uint32_t)blockSize * groupDescBlock)
+                + (blockGroup * sizeof(struct ext2_group_desc))
+                + offsetof(struct ext2_group_desc, bg_inode_table), &inodeTable, 4))
+            return 0;
+        tableGroup = blockGroup;
+        tableBlock = inodeTable;
+    }
+
+    //raw index to seek within the file, go to that block groups inode table, and index inside
+    indexToBlock(((uint32_t)blockSize * tableBlock) + (localIndex * inodeSize), block, offset);
+    return 1;
+}
+
+//Returns the device block holding block |fileBlock| of a file
+//|blocks| is the i_block array of its inode
+//Returns 0, which is never a data block, for a hole or when a pointer block
+//can't be read
+uint32_t inodeDataBlock(uint32_t* blocks, uint32_t fileBlock)
+{
+    uint32_t indirect, dataBlock;
+
+    if(fileBlock < DIRECT_BLOCKS)
+        return blocks[fileBlock];
+
+    fileBlock -= DIRECT_BLOCKS;
+    if(fileBlock < ptrsPerBlock)
+    {
+        //How far into the indirect block we need to look, 4 byte pointers
+        if(!blocks[EXT2_IND_BLOCK]
+            || !extRead(((uint32_t)blockSize * blocks[EXT2_IND_BLOCK]) + (fileBlock * 4),
+                &dataBlock, 4))
+            return 0;
+        return dataBlock;
+    }
+
+    //Get the pointer to the portion of the double indirect block we care about
+    fileBlock -= ptrsPerBlock;
+    if(!blocks[EXT2_DIND_BLOCK]
+        || !extRead(((uint32_t)blockSize * blocks[EXT2_DIND_BLOCK])
+            + ((fileBlock / ptrsPerBlock) * 4), &indirect, 4)
+        || !indirect)
+        return 0;
+
+    //Then the pointer inside that indirect block
+    if(!extRead(((uint32_t)blockSize * indirect) + ((fileBlock % ptrsPerBlock) * 4),
+            &dataBlock, 4))
+        return 0;
+    return dataBlock;
+}
+
+//Returns the device block holding block |fileBlock| of |file|, 0 if it has none
+//or it can't be looked up
+uint32_t fileDataBlock(struct ext_file* file, uint32_t fileBlock)
+{
+    uint8_t i;
+
+    if(!file->extents)
+    {
+        if(file != mapFile || fileBlock != mapFileBlock)
+        {
+            //A failed lookup isn't kept, the next read tries the card again
+            mapFile = NULL;
+            mapBlock = inodeDataBlock(file->map.block, fileBlock);
+            if(!mapBlock)
+                return 0;
+            mapFile = file;
+            mapFileBlock = fileBlock;
+        }
+        return mapBlock;
+    }
+    for(i = 0; i < file->extents; i++)
+    {
+        if(fileBlock < file->map.run.len[i])
+            return file->map.run.start[i] + fileBlock;
+        fileBlock -= file->map.run.len[i];
+    }
+    return 0;
+}
+
+//Reads |count| bytes at |offset| into the inode at |inodeNum|
+//Returns 1 on success and 0 on failure
+uint8_t inodeRead(uint32_t inodeNum, uint16_t offset, void* dst, uint16_t count)
+{
+    uint32_t block;
+    uint16_t inodeOffset;
+
+    return inodeToBlock(inodeNum, &block, &inodeOffset)
+        && bdRead(extDev, block, inodeOffset + offset, dst, count);
+}
+
+//Reads |count| bytes at |pos| in the index file, which must not cross a block
+//Only the one block pointer is read, not the whole block map, and 256 entries
+//never reach past the indirect block
+//Returns 1 on success and 0 on failure
+uint8_t indexRead(uint32_t pos, void* dst, uint16_t count)
+{
+    uint32_t fileBlock = pos / blockSize;
+    uint32_t block;
+
+    if(fileBlock < DIRECT_BLOCKS)
+    {
+        if(!inodeRead(indexInode, offsetof(struct ext2_inode, i_block) + fileBlock * 4, &block, 4))
+            return 0;
+    }
+    else if(!inodeRead(indexInode, offsetof(struct ext2_inode, i_block) + EXT2_IND_BLOCK * 4,
+            &block, 4)
+        || !extRead((uint32_t)blockSize * block + (fileBlock - DIRECT_BLOCKS) * 4, &block, 4))
+        return 0;
+    return extRead((uint32_t)blockSize * block + pos % blockSize, dst, count);
+}
+
+//Reads the index entry for the song at |songIndex| into |entry|
+//Entries are one entry size apart after a header padded to the same size,
+//so they never cross a block
+//Returns 0 if there is no current index or the entry is damaged
+uint8_t indexEntry(uint16_t songIndex, struct ext_index_entry* entry)
+{
+    if(!indexValid || songIndex >= songCount)
+        return 0;
+    if(!indexRead((uint32_t)(songIndex + 1) * sizeof(struct ext_index_entry), entry,
+            sizeof(struct ext_index_entry)))
+        return 0;
+    return entry->crc == crcCcitt(0xFFFF, entry, offsetof(struct ext_index_entry, crc));
+}
+
+#ifndef __AVR__
+//Fills in the index entry for the song at |songIndex| from the directory and
+//its inode, the caller adds the audio fields and the crc
+//Returns 0 if there is no such song
+uint8_t extIndexEntry(uint16_t songIndex, struct ext_index_entry* entry)
+{
+    struct ext2_inode inode;
+    char name[MAX_NAME_LEN];
+    uint32_t blocks, b, disk;
+    uint8_t n = 0;
+    uint8_t nameLen;
+
+    memset(entry, 0, sizeof(struct ext_index_entry));
+    entry->inode = searchRoot(songIndex, name).inode;
+    if(!entry->inode)
+        return 0;
+    inode = getInode(entry->inode);
+    entry->mtime = inode.i_mtime;
+    entry->size = inode.i_size;
+    //Longer names are cut short, the memset left the terminator
+    nameLen = strlen(name);
+    if(nameLen > EXT_INDEX_NAME_LEN - 1)
+        nameLen = EXT_INDEX_NAME_LEN - 1;
+    memcpy(entry->name, name, nameLen);
+
+    //Runs of consecutive blocks, a file in more runs than fit keeps the block map
+    blocks = (inode.i_size + blockSize - 1) / blockSize;
+    for(b = 0; b < blocks; b++)
+    {
+        disk = inodeDataBlock(inode.i_block, b);
+        //A hole or an unreadable block map, the song can't be indexed
+        if(!disk)
+            return 0;
+        if(n && disk == entry->extentStart[n - 1] + entry->extentLen[n - 1]
+            && entry->extentLen[n - 1] < 0xFFFF)
+            entry->extentLen[n - 1]++;
+        else if(n == EXT_INDEX_EXTENTS)
+        {
+            memset(entry->extentStart, 0, sizeof(entry->extentStart));
+            memset(entry->extentLen, 0, sizeof(entry->extentLen));
+            n = 0;
+            break;
+        }
+        else
+        {
+            entry->extentStart[n] = disk;
+            entry->extentLen[n++] = 1;
+        }
+    }
+    entry->extents = n;
+    return 1;
+}
+#endif
@@ -10,8 +10,16 @@
  *
  *  Copyright (C) 1991, 1992  Linus Torvalds
  */
+#ifndef EXT_H
+#define EXT_H
+#include <stdint.h>
+#include "globals.h"
 
-uint32_t fillBuffer(uint16_t songIndex, uint8_t buffer[256], uint32_t callCount);
+struct block_device;
+
+uint8_t extMount(struct block_device* dev);
+void getSongName(uint16_t index, char buffer[MAX_NAME_LEN]);
+struct ext2_inode getInode(int inodeNum);
 /*
  * Special inode numbers
  */
@@ -130,8 +138,14 @@ struct ext2_super_block {
    uint32_t s_rev_level;        /* Revision level */
    uint16_t s_def_resuid;       /* Default uid for reserved blocks */
    uint16_t s_def_resgid;       /* Default gid for reserved blocks */
+   /* EXT2_DYNAMIC_REV superblocks only */
+   uint32_t s_first_ino;        /* First non-reserved inode */
+   uint16_t s_inode_size;       /* size of inode structure */
+   uint16_t s_block_group_nr;   /* block group # of this superblock */
 };
 
+#define EXT2_SUPER_MAGIC    0xEF53
+
 /*
  * Revision levels
  */
@@ -164,4 +178,83 @@ enum {
    EXT2_FT_SOCK     = 6,
    EXT2_FT_SYMLINK  = 7,
    EXT2_FT_MAX
-};
\ No newline at end of file
+};
+
+/*
+ * Playlist index, written into a file in the root directory by tools/mkindex
+ * so songs can be opened without walking the directory or parsing headers
+ */
+#define EXT_INDEX_NAME ".songidx"
+#define EXT_INDEX_MAGIC 0x58444953UL  /* "SIDX" */
+#define EXT_INDEX_VERSION 1
+#define EXT_INDEX_EXTENTS 6
+#define EXT_INDEX_NAME_LEN 60
+
+struct ext_index_header {
+   uint32_t magic;
+   uint32_t dirMtime;       /* Root directory i_mtime when indexed */
+   uint16_t version;
+   uint16_t count;          /* Songs listed */
+   uint16_t entrySize;      /* sizeof(struct ext_index_entry) */
+   uint16_t crc;            /* CRC-CCITT of the header up to here */
+};
+
+/*
+ * Where a song's samples are, as wavOpen() would find them
+ */
+struct ext_index_audio {
+   uint32_t dataStart;
+   uint32_t dataSize;
+   uint16_t format;
+   uint16_t sampleRate;
+   uint16_t blockAlign;
+   uint8_t channels;
+   uint8_t bits;
+};
+
+struct ext_index_entry {
+   uint32_t inode;
+   uint32_t mtime;          /* Song i_mtime when indexed */
+   uint32_t size;           /* Song i_size */
+   uint32_t extentStart[EXT_INDEX_EXTENTS];  /* First block of each run */
+   uint16_t extentLen[EXT_INDEX_EXTENTS];    /* Blocks in each run */
+   struct ext_index_audio audio;
+   uint8_t extents;         /* Runs used, 0 when the song has more than fit */
+   uint8_t reserved;
+   char name[EXT_INDEX_NAME_LEN];
+   uint16_t crc;            /* CRC-CCITT of the entry up to here */
+};
+
+/*
+ * An open file, the inode fields needed to read it
+ * Files opened from the index may carry block runs instead of the block map
+ */
+struct ext_file {
+   uint32_t size;
+   uint8_t extents;         /* Runs in map.run, 0 to use map.block */
+   union {
+      uint32_t block[EXT2_N_BLOCKS];
+      struct {
+         uint32_t start[EXT_INDEX_EXTENTS];
+         uint16_t len[EXT_INDEX_EXTENTS];
+      } run;
+   } map;
+};
+
+uint8_t extOpen(uint16_t songIndex, struct ext_file* file, char name[MAX_NAME_LEN]);
+uint8_t extOpenIndexed(uint16_t songIndex, struct ext_file* file, char name[MAX_NAME_LEN],
+   struct ext_index_audio* audio);
+uint8_t extOpenInode(uint32_t inodeNum, struct ext_file* file);
+uint16_t extSongCount();
+uint16_t extCountSongs();
+uint8_t extIndexed();
+uint8_t extIndexLoad();
+uint8_t extFindRoot(const char* name, uint32_t* inodeNum);
+#ifndef __AVR__
+//Used by tools/mkindex to write the index
+uint8_t extIndexEntry(uint16_t songIndex, struct ext_index_entry* entry);
+#endif
+uint16_t extReadFile(struct ext_file* file, uint32_t pos, uint8_t* dst, uint16_t count);
+uint32_t extFileSector(struct ext_file* file, uint32_t pos);
+
+#endif
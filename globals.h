@@ -14,4 +14,8 @@
 #define MIN_COLOR 30
 #define MAX_COLOR 37
 
+//Audio
+#define BUFFER_SIZE 64 //bytes per loader read and per readahead block
+#define MAX_NAME_LEN 33 //song names are cut to what the screen shows
+
 #endif
@@ -0,0 +1,59 @@
+//Block device backed by a file on the build host, used to run the
+//filesystem code against ext2 images without the board
+#include <stdio.h>
+#include <string.h>
+#include "blockdev.h"
+
+uint8_t hostDiskRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count);
+uint8_t hostDiskReadMulti(struct block_device* dev, uint32_t sector, uint8_t* dst,
+   uint16_t n);
+uint8_t hostDiskGeometry(struct block_device* dev, struct blockdev_geometry* geo);
+
+//Opens the image at |path| as |dev|
+//Returns NULL if the file can't be opened
+struct block_device* hostDiskOpen(struct block_device* dev, const char* path)
+{
+   FILE* f = fopen(path, "rb");
+   if(!f)
+      return NULL;
+   memset(dev, 0, sizeof(struct block_device));
+   dev->read = hostDiskRead;
+   dev->readMulti = hostDiskReadMulti;
+   dev->geometry = hostDiskGeometry;
+   dev->priv = f;
+   return dev;
+}
+
+void hostDiskClose(struct block_device* dev)
+{
+   if(dev->priv)
+      fclose(dev->priv);
+   dev->priv = NULL;
+}
+
+uint8_t hostDiskRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count)
+{
+   long pos = (long)sector * BLOCKDEV_SECTOR_SIZE + offset;
+   if(fseek(dev->priv, pos, SEEK_SET))
+      return 0;
+   return fread(dst, 1, count, dev->priv) == count;
+}
+
+uint8_t hostDiskReadMulti(struct block_device* dev, uint32_t sector, uint8_t* dst,
+   uint16_t n)
+{
+   if(fseek(dev->priv, (long)sector * BLOCKDEV_SECTOR_SIZE, SEEK_SET))
+      return 0;
+   return fread(dst, BLOCKDEV_SECTOR_SIZE, n, dev->priv) == n;
+}
+
+uint8_t hostDiskGeometry(struct block_device* dev, struct blockdev_geometry* geo)
+{
+   if(fseek(dev->priv, 0, SEEK_END))
+      return 0;
+   geo->sectors = ftell(dev->priv) / BLOCKDEV_SECTOR_SIZE;
+   geo->sectorSize = BLOCKDEV_SECTOR_SIZE;
+   return 1;
+}
@@ -0,0 +1,69 @@
+#include "jitter.h"
+#include "os.h"
+
+struct jitter_stats jitterStats;
+uint16_t jitterLast;
+uint8_t jitterPrimed = 0;
+
+//Sets the interval samples are expected at and starts a fresh histogram
+void jitter_set_rate(uint16_t hz)
+{
+   uint16_t width;
+
+   jitterStats.nominal = F_CPU / CYCLES_PER_COUNT / hz;
+   width = jitterStats.nominal / JITTER_WIDTH_DIV;
+   //A power of two so a sample costs a shift, not a divide
+   for(jitterStats.shift = 0; width > 1; width >>= 1)
+      jitterStats.shift++;
+   jitter_reset();
+}
+
+//Call as each sample goes out, files the time since the last one
+void jitter_sample()
+{
+   uint16_t now = cycle_stamp();
+   uint16_t interval = now - jitterLast;
+   int16_t bucket;
+   uint8_t i;
+
+   if(now < jitterLast)
+      interval += RUNTIME_COMPARE + 1;
+   jitterLast = now;
+   //The first sample has nothing to measure from
+   if(!jitterPrimed)
+   {
+      jitterPrimed = 1;
+      return;
+   }
+
+   if(interval > jitterStats.maxInterval)
+      jitterStats.maxInterval = interval;
+   bucket = ((int16_t)(interval - jitterStats.nominal) >> jitterStats.shift) + JITTER_BUCKETS / 2;
+   if(bucket < 0)
+      bucket = 0;
+   else if(bucket >= JITTER_BUCKETS)
+      bucket = JITTER_BUCKETS - 1;
+
+   //Halve everything rather than wrap, the shape is what matters
+   if(++jitterStats.buckets[bucket] == 0xFFFF)
+   {
+      for(i = 0; i < JITTER_BUCKETS; i++)
+         jitterStats.buckets[i] >>= 1;
+   }
+}
+
+//Empties the histogram
+void jitter_reset()
+{
+   uint8_t i;
+   for(i = 0; i < JITTER_BUCKETS; i++)
+      jitterStats.buckets[i] = 0;
+   jitterStats.maxInterval = 0;
+   jitterPrimed = 0;
+}
+
+//Returns a pointer to the histogram
+struct jitter_stats* get_jitter_stats()
+{
+   return &jitterStats;
+}
@@ -0,0 +1,22 @@
+#ifndef JITTER_H
+#define JITTER_H
+#include <stdint.h>
+
+//Histogram buckets, half below the nominal sample interval and half above
+#define JITTER_BUCKETS 8
+//Buckets are about this fraction of the nominal interval wide
+#define JITTER_WIDTH_DIV 8
+
+struct jitter_stats {
+   uint16_t buckets[JITTER_BUCKETS];
+   uint16_t nominal;       //Expected interval between samples in timer 1 counts
+   uint8_t shift;          //Buckets are 1 << shift counts wide
+   uint16_t maxInterval;   //Longest interval seen in timer 1 counts
+};
+
+void jitter_set_rate(uint16_t hz);
+void jitter_sample();
+void jitter_reset();
+struct jitter_stats* get_jitter_stats();
+
+#endif
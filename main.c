@@ -1,35 +1,160 @@
 #include <stdlib.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "os.h"
 #include "ext.h"
 #include "globals.h"
 #include "syncro.h"
 #include "SdReader.h"
+#include "blockdev.h"
+#include "readahead.h"
+#include "wav.h"
+#include "mixer.h"
+#include "eq.h"
+#include "jitter.h"
+#include "serial.h"
+#include "screen.h"
+#include "telemetry.h"
+#include "shell.h"
+#include "boot.h"
 #include <util/delay.h>
 
+//Nonzero runs the card at 4 MHz instead of 8, for early Wave Shields
+#ifndef SD_SLOW_SPI
+#define SD_SLOW_SPI 0
+#endif
 #define STEP 5
-#define STAT_DELAY 5000
-#define NUM_SONGS 13
-#define BUFFER_SIZE 256
-#define MAX_NAME_LEN 75
-
-mutex_t bufferZero;
-mutex_t bufferOne;
-mutex_t nameMut;
-char songName[MAX_NAME_LEN];
-uint32_t remaining;
-uint8_t songIndex = 0;
-uint32_t callCount = 0;
-uint32_t songSize = 0;
-uint8_t readBuffer = 1;
-uint8_t writeBuffer = 0;
-uint8_t buffer[2][BUFFER_SIZE];
+//How often the stats screen is brought up to date
+#define STAT_PERIOD_MS 200
+//Nonzero starts with binary telemetry instead of the stats screen, t switches
+#ifndef STAT_TELEMETRY
+#define STAT_TELEMETRY 0
+#endif
+#define RAW_CHUNK 64 //bytes of multi-byte frames converted at a time
+//Blocks of audio left in a song when the loader resolves the next one
+#define PREFETCH_BLOCKS READAHEAD_BLOCKS
+//How long the loader waits before another pass when nothing in the library plays
+#define LOADER_RETRY_MS 1000
+//How far the f and b keys jump
+#define SEEK_STEP_MS 5000
+//Voice the c key plays its cue on, and how loud and long the cue is
+#define CUE_VOICE 1
+#define CUE_GAIN (MIX_UNITY / 2)
+#define CUE_REPEAT 40
+//How often the stats thread looks for keys between redraws
+#define SHELL_POLL_MS 20
+//What each thread needs on its own stack, the kernel adds the rest
+#define PLAYER_STACK 24   //mixer calls need a little more than 10
+#define LOADER_STACK 368  //opening a song from the index is the deepest it goes
+#define CONSOLE_STACK 160 //telemetry payloads and shell commands are built on the stack
+
+//A thread added here without room in OS_STACK_BYTES fails the build
+typedef char thread_stacks_fit[THREAD_STACK_BYTES(PLAYER_STACK)
+  + THREAD_STACK_BYTES(LOADER_STACK) + THREAD_STACK_BYTES(CONSOLE_STACK)
+  <= OS_STACK_BYTES ? 1 : -1];
+
+//Values on the stats screen, in the order of statFields
+enum stat_field {
+  STAT_TIME, STAT_TICK_RATE, STAT_THREADS,
+  STAT_SONG,
+  STAT_SIZE, STAT_REMAINING, STAT_POSITION,
+  STAT_RA_DEPTH, STAT_RA_TARGET, STAT_RA_MIN, STAT_RA_SLOW,
+  STAT_STALLS, STAT_STALL_TICKS, STAT_HEADROOM, STAT_REFILL_AVG, STAT_REFILL_MAX,
+  STAT_JIT_NOMINAL, STAT_JIT_MAX, STAT_JIT_BUCKET,
+  STAT_JIT_COUNT,
+  STAT_ADPCM = STAT_JIT_COUNT + JITTER_BUCKETS, STAT_ADPCM_BUDGET,
+  STAT_EQ_PRESET, STAT_EQ_CYCLES,
+  STAT_BOOT,
+  STAT_KEYS_LOST = STAT_BOOT + BOOT_PHASES, STAT_TX_WAITS, STAT_SCREEN_BYTES,
+  STAT_DATA, STAT_BSS, STAT_HEAP, STAT_STACKS, STAT_GAP, STAT_GAP_MIN,
+  STAT_FIELDS
+};
+
+//A song opened for the loader
+struct track {
+  struct ext_file file;
+  struct wav_info wav;
+  uint32_t pos;           //File offset of the next byte to load
+  uint32_t remaining;     //Sample bytes left to load
+  uint8_t index;
+  uint8_t ready;          //Opened ahead of time by prefetch_song()
+  char name[MAX_NAME_LEN];
+};
+
+mutex_t fsMut;        //The card and the filesystem are shared by the loader and shell
+mutex_t consoleMut;   //The stats and the shell take turns on the terminal
+uint8_t telemetryWanted = STAT_TELEMETRY;
+uint8_t traceWanted = 0;
+uint32_t bootTimes[BOOT_PHASES];
+int8_t songStep = 0;    //Songs to move on by, set by the p and n keys
+uint16_t prefetchCount; //Song count nextSong was picked with
+uint16_t adpcmCycles;
+uint16_t eqCycles;
+uint8_t eqWanted = EQ_FLAT;
+struct track tracks[2];
+struct track* song = &tracks[0];
+struct track* nextSong = &tracks[1];
+uint32_t seekMs;
+uint8_t seekPending = 0;
+//Where each stat goes, in flash
+const struct screen_field statFields[STAT_FIELDS] PROGMEM = {
+  {1, 7, 6}, {1, 28, 6}, {1, 46, 2},
+  {2, 7, MAX_NAME_LEN - 1},
+  {3, 7, 10}, {3, 31, 10}, {3, 55, 5},
+  {4, 12, 1}, {4, 14, 1}, {4, 21, 1}, {4, 30, 5},
+  //Ticks are sample periods, so these are all in samples
+  {5, 12, 5}, {5, 25, 8}, {5, 50, 5},
+  {5, 69, 5}, {5, 80, 5},
+  {6, 20, 5}, {6, 32, 5}, {6, 52, 5},
+  {7, 10, 5}, {7, 16, 5}, {7, 22, 5}, {7, 28, 5},
+  {7, 34, 5}, {7, 40, 5}, {7, 46, 5}, {7, 52, 5},
+  {8, 22, 5}, {8, 31, 5},
+  {9, 12, 1}, {9, 39, 5},
+  {10, 15, 5}, {10, 28, 5}, {10, 41, 5},
+  {10, 60, 5}, {10, 74, 5},
+  {11, 19, 5}, {11, 36, 5}, {11, 62, 10},
+  {12, 12, 5}, {12, 23, 5}, {12, 35, 5}, {12, 49, 5},
+  {12, 60, 5}, {12, 71, 5},
+};
+//The label of each field, ending just left of its value
+const char statLabels[] PROGMEM =
+  "Time: \0" "Ticks/s: \0" "Threads: \0"
+  "Song: \0"
+  "Size: \0" "Remaining: \0" "Position s: \0"
+  "Readahead: \0" "/\0" " min: \0" " slow: \0"
+  "Underruns: \0" " lost: \0" " headroom min: \0"
+  " refill avg: \0" " max: \0"
+  "Jitter us nominal: \0" " max: \0" " per bucket: \0"
+  "Buckets: \0" " \0" " \0" " \0"
+  " \0" " \0" " \0" " \0"
+  "ADPCM cycles/sample: \0" " of \0"
+  "EQ preset: \0" " cycles/sample/section: \0"
+  "Boot ms: card \0" " mount \0" " start \0"
+  " first sample \0" " indexed \0"
+  "Serial keys lost: \0" " tx waits: \0" " screen bytes: \0"
+  "SRAM data: \0" " bss: \0" " heap: \0" " stacks: \0"
+  " gap: \0" " min: \0";
+uint32_t statShadow[STAT_FIELDS];
+//One period of a triangle wave for the cue voice
+const uint8_t cueTone[16] = {128, 160, 192, 224, 255, 224, 192, 160,
+                             128, 96, 64, 32, 0, 32, 64, 96};
 
 void display_stats();
+void handle_key(char key);
+void send_telemetry();
 void load_audio_file();
 void play_audio_pwm();
-char* getSongName(uint16_t index, char buffer[MAX_NAME_LEN]);
+void boot_mark(uint8_t phase);
+uint8_t song_after(uint8_t index, int8_t step);
+void open_song(struct track* t, uint8_t index);
+void start_song(uint8_t index);
+void prefetch_song();
+void drop_prefetch();
+void next_song();
+void seek(uint32_t ms);
+uint32_t song_position();
+void apply_seek();
 
 
 int main(void)
@@ -37,150 +162,505 @@ int main(void)
   int i;
   uint8_t sd_card_status;
 
-  sd_card_status = sdInit(1);
+  //The runtime clock times the boot, it needs interrupts to count
+  start_runtime_clock();
+  sei();
+
+  sd_card_status = sdInit(SD_SLOW_SPI);
   //Make sure the initialization was successful
   if(!sd_card_status)
     return 0;
+  boot_mark(BOOT_CARD);
 
   start_audio_pwm();
 
   os_init();
+  adpcmCycles = adpcmBenchmark();
+  eqCycles = eqBenchmark();
+#ifdef SERIAL_BENCHMARK
+  serial_benchmark();
+  print_fmt_P(PSTR("Press a key to play\r\n"));
+  read_byte_wait();
+#endif
   //create_threads here
-  create_thread(play_audio_pwm, NULL, 10); //10
-  create_thread(load_audio_file, NULL, 468); //468
-  create_thread(display_stats, NULL, 80); //???
+  if(!create_thread((uint16_t)play_audio_pwm, NULL, PLAYER_STACK)
+    || !create_thread((uint16_t)load_audio_file, NULL, LOADER_STACK)
+    //Runs the shell too, between redraws
+    || !create_thread((uint16_t)display_stats, NULL, CONSOLE_STACK))
+  {
+    print_fmt_P(PSTR("No room for the threads\r\n"));
+    return 0;
+  }
 
-  mutex_init(&bufferZero);
-  mutex_init(&bufferOne);
-  mutex_init(&nameMut);
+  mutex_init(&fsMut);
+  mutex_init(&consoleMut);
+  shell_init(&consoleMut, &fsMut, handle_key);
+  raInit();
+  mix_init();
 
+  boot_mark(BOOT_START);
   os_start();
   while(1){}
 }
 
-//Displays stats about the system and each individual thread
+//Acts on a key typed outside a shell command line
+void handle_key(char key)
+{
+  uint32_t pos;
+
+  if(key == 'p')
+  {
+    songStep = -1;
+  }
+  else if(key == 'n')
+  {
+    songStep = 1;
+  }
+  else if(key == 'f')
+  {
+    seek(song_position() + SEEK_STEP_MS);
+  }
+  else if(key == 'b')
+  {
+    pos = song_position();
+    seek(pos > SEEK_STEP_MS ? pos - SEEK_STEP_MS : 0);
+  }
+  else if(key == 'c')
+  {
+    mix_play(CUE_VOICE, cueTone, sizeof(cueTone), CUE_GAIN, CUE_REPEAT);
+  }
+  else if(key == 'e')
+  {
+    eqWanted = (eqWanted + 1) % EQ_PRESETS;
+  }
+  //The stats thread owns the output for these two
+  else if(key == 'd')
+  {
+    traceWanted = 1;
+  }
+  else if(key == 't')
+  {
+    telemetryWanted = !telemetryWanted;
+  }
+}
+
+//Displays stats about the system and each individual thread, sending only
+//what changed since the last pass, and runs the shell in between
 void display_stats()
 {
    struct system_t* sysInfo;
+   struct readahead_stats* ra = getReadaheadStats();
+   struct jitter_stats* jit = get_jitter_stats();
+   struct memory_map* mem;
    uint8_t i;
-   uint8_t row = 2;
-   uint8_t col = 0;
-   char input;
+   uint8_t polls = 0;
+   uint8_t telemetry = !STAT_TELEMETRY; //so the first pass sets the screen up
    sysInfo = (struct system_t *)getSystemInfo();
-   clear_screen();
    while(1)
    {
-      //Check for input
-      if(byte_available())
-        input = read_byte();
-      if(input == 'p')
+      thread_sleep(ms_to_ticks(SHELL_POLL_MS));
+      //Takes the terminal itself for what it prints
+      shell_poll();
+      if(++polls < STAT_PERIOD_MS / SHELL_POLL_MS)
+        continue;
+      polls = 0;
+      mutex_lock(&consoleMut);
+
+      if(traceWanted)
       {
-        songIndex = (songIndex - 1) % (NUM_SONGS - 1); 
-        callCount = 0;
+        //The trace goes out as telemetry frames, see tools/telemdump -t
+        traceWanted = 0;
+        telem_trace();
+        telemetry = !telemetryWanted;
       }
-      else if(input == 'n')
+      //The screen has to be drawn from scratch after binary frames
+      if(telemetry != telemetryWanted)
       {
-        songIndex = (songIndex + 1) % (NUM_SONGS - 1);
-        callCount = 0; 
+        telemetry = telemetryWanted;
+        if(!telemetry)
+          screen_init(statFields, statLabels, statShadow, STAT_FIELDS);
       }
-      input = 0;
 
-      set_color(GREEN);
-      set_cursor(1, col);
-      
-      print_string("Time: ");
-      print_int(sysInfo->runtime);
-      set_cursor(row, col);
-      print_string("Interrupts: ");
-      print_string("     ");
-      set_cursor(row++, 13);
-      print_int(sysInfo->interrupts / sysInfo->runtime);
-      set_cursor(row++, col);
-      row++;
-      print_string("# threads: ");
-      print_int(sysInfo->numThreads);
-      set_cursor(row++, col);
-      print_string("Size: ");
-      print_int32(songSize);
-      set_cursor(row, col);
-      print_string("remaining: ");
-      print_string("       ");
-      set_cursor(row++, 12);
-      print_int32(remaining);
-      set_cursor(row, col);
-      print_string("                                                        ");
-      set_cursor(row, col);
-      print_string(songName);
-      
-      //thread_sleep(STAT_DELAY);
-      row = 2;
-      col = 0;
-      set_cursor(row, col);
+      if(telemetry)
+      {
+        send_telemetry();
+        mutex_unlock(&consoleMut);
+        continue;
+      }
+
+      screen_number(STAT_TIME, sysInfo->runtime);
+      if(sysInfo->runtime)
+        screen_number(STAT_TICK_RATE, sysInfo->interrupts / sysInfo->runtime);
+      screen_number(STAT_THREADS, sysInfo->numThreads);
+      screen_text(STAT_SONG, song->name);
+      screen_number(STAT_SIZE, song->wav.dataSize);
+      screen_number(STAT_REMAINING, song->remaining);
+      screen_number(STAT_POSITION, song_position() / 1000);
+      screen_number(STAT_RA_DEPTH, ra->depth);
+      screen_number(STAT_RA_TARGET, ra->target);
+      screen_number(STAT_RA_MIN, ra->minDepth);
+      screen_number(STAT_RA_SLOW, ra->slowReads);
+      screen_number(STAT_STALLS, ra->stalls);
+      screen_number(STAT_STALL_TICKS, ra->stallTicks);
+      screen_number(STAT_HEADROOM, ra->minDepth * BUFFER_SIZE);
+      screen_number(STAT_REFILL_AVG, ra->fills ? ra->totalLatency / ra->fills : 0);
+      screen_number(STAT_REFILL_MAX, ra->maxLatency);
+      screen_number(STAT_JIT_NOMINAL, COUNTS_TO_US(jit->nominal));
+      screen_number(STAT_JIT_MAX, COUNTS_TO_US(jit->maxInterval));
+      screen_number(STAT_JIT_BUCKET, COUNTS_TO_US((uint16_t)1 << jit->shift));
+      for(i = 0; i < JITTER_BUCKETS; i++)
+        screen_number(STAT_JIT_COUNT + i, jit->buckets[i]);
+      screen_number(STAT_ADPCM, adpcmCycles);
+      screen_number(STAT_ADPCM_BUDGET, F_CPU / get_tick_rate());
+      screen_number(STAT_EQ_PRESET, eqWanted);
+      screen_number(STAT_EQ_CYCLES, eqCycles);
+      for(i = 0; i < BOOT_PHASES; i++)
+        screen_number(STAT_BOOT + i, bootTimes[i] / 1000);
+      screen_number(STAT_KEYS_LOST, get_serial_stats()->rxDropped);
+      screen_number(STAT_TX_WAITS, get_serial_stats()->txWaits);
+      screen_number(STAT_SCREEN_BYTES, screen_bytes());
+
+      mem = get_memory_map();
+      screen_number(STAT_DATA, mem->data);
+      screen_number(STAT_BSS, mem->bss);
+      screen_number(STAT_HEAP, mem->heap);
+      screen_number(STAT_STACKS, mem->stacks);
+      screen_number(STAT_GAP, mem->gap);
+      screen_number(STAT_GAP_MIN, mem->minGap);
+      mutex_unlock(&consoleMut);
   }
 }
 
+//Sends the system, each thread and the playback counters as telemetry frames
+void send_telemetry()
+{
+   struct system_t* sysInfo = getSystemInfo();
+   struct readahead_stats* ra = getReadaheadStats();
+   struct telem_system sys;
+   struct telem_thread thread;
+   struct telem_playback play;
+   uint8_t i;
+
+   sys.ticks = getTicks();
+   sys.runtime = sysInfo->runtime;
+   sys.interrupts = sysInfo->interrupts;
+   sys.tickHz = get_tick_rate();
+   sys.numThreads = sysInfo->numThreads;
+   sys.curThread = sysInfo->curThread;
+   telem_send(TELEM_SYSTEM, &sys, sizeof(sys));
+
+   for(i = 0; i < sysInfo->numThreads; i++)
+   {
+      thread.id = sysInfo->threads[i].id;
+      thread.state = sysInfo->threads[i].state;
+      thread.stackSize = sysInfo->threads[i].stackSize;
+      thread.stackUsed = sysInfo->threads[i].stackBase + sysInfo->threads[i].stackSize
+        - sysInfo->threads[i].stackPtr;
+      thread.sleepCount = sysInfo->threads[i].sleepCount;
+      telem_send(TELEM_THREAD, &thread, sizeof(thread));
+   }
+
+   play.song = song->index;
+   play.songs = extSongCount();
+   play.sampleRate = song->wav.sampleRate;
+   play.positionMs = song_position();
+   play.remaining = song->remaining;
+   play.raDepth = ra->depth;
+   play.raTarget = ra->target;
+   play.raMinDepth = ra->minDepth;
+   play.stalls = ra->stalls;
+   play.stallTicks = ra->stallTicks;
+   play.slowReads = ra->slowReads;
+   play.maxLatency = ra->maxLatency;
+   play.jitterMaxUs = COUNTS_TO_US(get_jitter_stats()->maxInterval);
+   play.eqPreset = eqWanted;
+   play.rxDropped = get_serial_stats()->rxDropped;
+   telem_send(TELEM_PLAYBACK, &play, sizeof(play));
+}
+
 void play_audio_pwm() {
-  int i = 0;
+  uint16_t rate = 0;
+  struct ra_block* block;
    
   while (1) {
-    if(readBuffer == 0)
-      mutex_lock(&bufferZero);
-    else
-      mutex_lock(&bufferOne);
-      
+      block = raReadBlock();
+      boot_mark(BOOT_FIRST_SAMPLE);
+      //Move the sample clock when a song with a different rate starts
+      if(block->rate != rate)
+      {
+        rate = block->rate;
+        set_sample_rate(rate);
+        jitter_set_rate(rate);
+      }
  
-      while(i < BUFFER_SIZE) 
+      //The song is voice 0, anything else playing is mixed over it
+      mix_play(0, block->data, block->len, MIX_UNITY, 0);
+      while(!mix_done(0))
       {
-          OCR2B = buffer[readBuffer][i++];
+          OCR2B = mix_sample();
+          jitter_sample();
           yield();
       }
       
-      i = 0;
-      if(readBuffer == 0)
-        mutex_unlock(&bufferZero);
-      else
-        mutex_unlock(&bufferOne);
-
-      readBuffer = (readBuffer + 1) % 2;
+      raReleaseBlock();
   } 
 }
 
+//Returns the index of the song |step| places on from |index|, wrapping around
+//A count of 0 means the library hasn't been counted yet, not that it is empty,
+//so the directory is counted here rather than wrapping to the first song
+//Only the loader calls this, with fsMut held
+uint8_t song_after(uint8_t index, int8_t step)
+{
+  uint16_t count = extSongCount();
+  if(!count)
+    count = extCountSongs();
+  if(!count)
+    return 0;
+  return (index + count + step) % count;
+}
+
+//Opens the song at |index| into |t| and finds its sample data
+//Uses the playlist index when it is current, otherwise the directory and WAV header
+//The name comes from the same index entry or directory entry, so a prefetched
+//song is ready to show as soon as it is spliced in
+//Leaves nothing remaining if the song can't be played
+void open_song(struct track* t, uint8_t index)
+{
+  struct ext_index_audio audio;
+  uint8_t ok;
+
+  t->index = index;
+  t->remaining = 0;
+  t->ready = 1;
+  if(extOpenIndexed(index, &t->file, t->name, &audio))
+    ok = wavOpenIndexed(&audio, &t->wav);
+  else
+    ok = extOpen(index, &t->file, t->name) && wavOpen(&t->file, &t->wav);
+  if(!ok)
+  {
+    t->wav.dataSize = 0;
+    return;
+  }
+  t->pos = t->wav.dataStart;
+  t->remaining = t->wav.dataSize;
+}
+
+//Makes the song at |index| the one being loaded, forgetting any prefetch
+void start_song(uint8_t index)
+{
+  drop_prefetch();
+  open_song(song, index);
+}
+
+//Resolves the song after the current one while the current one is still loading
+//so moving on to it costs no directory or inode reads
+void prefetch_song()
+{
+  open_song(nextSong, song_after(song->index, 1));
+  prefetchCount = extSongCount();
+}
+
+//Forgets the prefetched song
+void drop_prefetch()
+{
+  nextSong->ready = 0;
+}
+
+//Moves the loader on to the song after the current one
+//Uses the prefetched song when there is one, name and all
+void next_song()
+{
+  struct track* t;
+
+  //The wrap point moved since it was picked
+  if(nextSong->ready && prefetchCount != extSongCount())
+    drop_prefetch();
+  if(!nextSong->ready)
+    open_song(nextSong, song_after(song->index, 1));
+  t = song;
+  song = nextSong;
+  nextSong = t;
+  nextSong->ready = 0;
+}
+
+//Asks the loader to move the current song to |ms| from its start
+//Audio already in the ring plays out first
+void seek(uint32_t ms)
+{
+  uint8_t sreg = SREG;
+  cli();
+  seekMs = ms;
+  seekPending = 1;
+  SREG = sreg;
+}
+
+//Returns how far into the current song the loader has got in milliseconds
+uint32_t song_position()
+{
+  struct track* t;
+  uint32_t pos;
+  uint8_t sreg = SREG;
+
+  cli();
+  t = song;
+  pos = t->pos - t->wav.dataStart;
+  SREG = sreg;
+  if(!t->wav.dataSize)
+    return 0;
+  return wavMillis(&t->wav, pos);
+}
+
+//Moves the song being loaded to the position asked for by seek()
+//Only the inode block map is walked, no sample data before the target is read
+void apply_seek()
+{
+  uint32_t ms, offset;
+  uint8_t sreg = SREG;
+
+  cli();
+  ms = seekMs;
+  seekPending = 0;
+  SREG = sreg;
+  if(!song->wav.dataSize)
+    return;
+  offset = wavSeek(&song->wav, ms);
+  song->pos = song->wav.dataStart + offset;
+  song->remaining = song->wav.dataSize - offset;
+}
+
 void load_audio_file() {
-  uint8_t index = 0;
-  uint8_t i;
-  uint8_t currentSong = songIndex;
-  getSongName(songIndex, songName);
+  struct ra_block* block;
+  uint8_t raw[RAW_CHUNK];
+  uint8_t* src;
+  uint16_t want, got;
+  uint8_t skipped;
+  int8_t step;
+  uint8_t eqPreset = EQ_FLAT;
+  uint16_t eqRate = 0;
+  struct readahead_stats* ra = getReadaheadStats();
+
+  //Mounted here rather than in main() so its deep stack is the loader's,
+  //main()'s has nothing set aside for it
+  mutex_lock(&fsMut);
+  if(!extMount(sdDevice()))
+  {
+    mutex_unlock(&fsMut);
+    mutex_lock(&consoleMut);
+    print_fmt_P(PSTR("No ext2 filesystem on the card\r\n"));
+    mutex_unlock(&consoleMut);
+    //Threads can't exit
+    while(1)
+      thread_sleep(0xFFFF);
+  }
+  boot_mark(BOOT_MOUNT);
+  start_song(0);
+  mutex_unlock(&fsMut);
   while(1)
   {
-    if(writeBuffer == 0)
-      mutex_lock(&bufferZero);
-    else
-      mutex_lock(&bufferOne);
-    remaining = fillBuffer(songIndex, buffer[writeBuffer], callCount++);
-    
-    if(callCount == 1)
+    //Waits until the ring has room below the readahead target
+    block = raWriteBlock();
+    block->len = 0;
+    mutex_lock(&fsMut);
+
+    //A key press picked another song
+    if(songStep)
     {
-      songSize = remaining + BUFFER_SIZE;
+      step = songStep;
+      songStep = 0;
+      start_song(song_after(song->index, step));
     }
-    //We've finished reading this file switch to the next
-    if(remaining < BUFFER_SIZE)
+    if(seekPending)
+      apply_seek();
+    block->rate = wavOutputRate(&song->wav);
+    skipped = 0;
+
+    while(block->len < BUFFER_SIZE)
     {
-      songIndex = (songIndex + 1) % (NUM_SONGS - 1);
-      callCount = 0;
+      if(!song->remaining)
+      {
+        //Carry straight on with the next song in the same block
+        next_song();
+        if(song->remaining && wavOutputRate(&song->wav) != block->rate)
+        {
+          //The player only changes rate between blocks
+          if(block->len)
+            break;
+          block->rate = wavOutputRate(&song->wav);
+        }
+        //Nothing in the directory can be played
+        if(++skipped > extSongCount())
+          break;
+        continue;
+      }
+
+      //Whole frames, no more than fits in the block
+      want = wavBytesFor(&song->wav, BUFFER_SIZE - block->len);
+      if(!want)
+        break;
+      if(want > song->remaining)
+        want = song->remaining;
+      //8-bit mono goes straight into the block, anything else through raw
+      src = block->data + block->len;
+      if(song->wav.blockAlign > 1 || song->wav.decimate > 1)
+      {
+        src = raw;
+        if(want > RAW_CHUNK)
+          want = RAW_CHUNK;
+        //A decimated frame group can straddle RAW_CHUNK, read whole groups
+        if(song->wav.decimate > 1)
+          want -= want % wavBytesFor(&song->wav, 1);
+      }
+
+      got = extReadFile(&song->file, song->pos, src, want);
+      if(!got)
+      {
+        song->remaining = 0;
+        continue;
+      }
+      song->pos += got;
+      song->remaining -= got;
+      block->len += wavConvert(&song->wav, src, got, block->data + block->len);
     }
 
-    //Check if a new song is loaded
-    if(currentSong != songIndex)
+    //A rate change can leave a short block, an unreadable directory none at all
+    if(block->len)
     {
-      currentSong = songIndex;
-      getSongName(songIndex, songName);
+      //The filters are designed for one rate, redo them when it changes
+      if(eqWanted != eqPreset || block->rate != eqRate)
+      {
+        eqPreset = eqWanted;
+        eqRate = block->rate;
+        eqSetPreset(eqPreset, eqRate);
+      }
+      eqProcess(block->data, block->len);
+      raCommitBlock();
     }
-    
-    if(writeBuffer == 0)
-        mutex_unlock(&bufferZero);
-    else
-        mutex_unlock(&bufferOne);
 
-    writeBuffer = (writeBuffer + 1) % 2;
+    //Get the next song ready while this one still has a ring's worth left
+    if(!nextSong->ready && song->remaining <=
+        (uint32_t)wavBytesFor(&song->wav, BUFFER_SIZE) * PREFETCH_BLOCKS)
+      prefetch_song();
+    //Count the songs once playback is under way with a full ring, unless
+    //the playlist index already had them
+    if(!bootTimes[BOOT_INDEXED] && bootTimes[BOOT_FIRST_SAMPLE]
+        && ra->depth >= ra->target)
+    {
+      if(!extIndexed() && !extSongCount())
+        extCountSongs();
+      boot_mark(BOOT_INDEXED);
+    }
+    mutex_unlock(&fsMut);
+    //A whole pass found nothing to play, don't keep the card and the shell's
+    //lock busy going round again straight away
+    if(!block->len)
+      thread_sleep(ms_to_ticks(LOADER_RETRY_MS));
   }
-}
\ No newline at end of file
+}
+
+//Records when the boot reached |phase|, only the first time
+void boot_mark(uint8_t phase)
+{
+  if(!bootTimes[phase])
+    bootTimes[phase] = os_micros();
+}
@@ -0,0 +1,89 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "mixer.h"
+
+#if MIX_VOICES < 1 || MIX_VOICES > 4
+#error MIX_VOICES must be 1 to 4
+#endif
+
+struct mix_voice mixVoices[MIX_VOICES];
+
+//Silences every voice
+void mix_init()
+{
+   uint8_t i;
+   for(i = 0; i < MIX_VOICES; i++)
+      mix_play(i, 0, 0, MIX_UNITY, 0);
+}
+
+//Starts |voice| on |len| samples at |data|, played |repeat| more times after the first
+//The buffer must stay put until mix_done() says the voice has finished with it
+void mix_play(uint8_t voice, const uint8_t* data, uint16_t len, uint8_t gain, uint8_t repeat)
+{
+   struct mix_voice* v = &mixVoices[voice];
+   uint8_t sreg = SREG;
+
+   cli();
+   v->data = data;
+   v->len = len;
+   v->pos = 0;
+   v->gain = gain;
+   v->repeat = repeat;
+   SREG = sreg;
+}
+
+//Changes the gain of |voice| without restarting it
+void mix_gain(uint8_t voice, uint8_t gain)
+{
+   mixVoices[voice].gain = gain;
+}
+
+//Returns 1 once |voice| has played everything it was given
+uint8_t mix_done(uint8_t voice)
+{
+   struct mix_voice* v = &mixVoices[voice];
+   return v->pos >= v->len && !v->repeat;
+}
+
+//Returns sample |s| centred on zero and scaled by Q1.7 |gain|
+//A signed by unsigned byte multiply, avr-gcc turns this into one mulsu
+static inline int16_t mix_scale(uint8_t s, uint8_t gain)
+{
+   return ((int16_t)(int8_t)(s ^ 0x80) * gain) >> 7;
+}
+
+//Adds the next sample of voice |n| to acc, voices past their end add nothing
+//Unrolled rather than looped so the build can count the cycles of mix_sample()
+#define MIX_ADD(n) \
+   v = &mixVoices[n]; \
+   if(v->pos >= v->len && v->repeat) \
+   { \
+      v->pos = 0; \
+      v->repeat--; \
+   } \
+   if(v->pos < v->len) \
+      acc += mix_scale(v->data[v->pos++], v->gain);
+
+//Returns the next output sample, the sum of every voice clipped to 8 bits
+uint8_t mix_sample()
+{
+   struct mix_voice* v;
+   int16_t acc = 0;
+
+   MIX_ADD(0)
+#if MIX_VOICES > 1
+   MIX_ADD(1)
+#endif
+#if MIX_VOICES > 2
+   MIX_ADD(2)
+#endif
+#if MIX_VOICES > 3
+   MIX_ADD(3)
+#endif
+
+   if(acc > 127)
+      acc = 127;
+   else if(acc < -128)
+      acc = -128;
+   return (uint8_t)acc ^ 0x80;
+}
@@ -0,0 +1,26 @@
+#ifndef MIXER_H
+#define MIXER_H
+#include <stdint.h>
+
+//Voices mixed into every output sample, voice 0 is the song, up to 4
+#ifndef MIX_VOICES
+#define MIX_VOICES 2
+#endif
+//Gains are Q1.7, this is 1.0
+#define MIX_UNITY 0x80
+
+struct mix_voice {
+   const uint8_t* data;    //Unsigned 8-bit samples
+   uint16_t len;
+   uint16_t pos;
+   uint8_t gain;
+   uint8_t repeat;         //Times left to start over from the beginning
+};
+
+void mix_init();
+void mix_play(uint8_t voice, const uint8_t* data, uint16_t len, uint8_t gain, uint8_t repeat);
+void mix_gain(uint8_t voice, uint8_t gain);
+uint8_t mix_done(uint8_t voice);
+uint8_t mix_sample();
+
+#endif
@@ -1,14 +1,18 @@
-#include <stdlib.h>
+#include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "globals.h"
 #include "os.h"
+#include "serial.h"
 
 void os_init();
-void create_thread(uint16_t address, void* args, uint16_t stack_size);
+uint8_t create_thread(uint16_t address, void* args, uint16_t stack_size);
 void os_start();
 uint8_t get_next_thread();
 void start_system_timer();
+void start_runtime_clock();
+uint16_t cycle_stamp();
+uint32_t cycles_since(uint16_t stamp);
 __attribute__((naked)) void context_switch(uint16_t* new_tp, uint16_t* old_tp);
 __attribute__((naked)) void thread_start(void);
 struct system_t* getSystemInfo();
@@ -16,9 +20,34 @@ int getCurrentThread();
 void setThreadState(int threadNum, threadState_t state);
 void threadSwap(int newThread, int oldThread);
 void thread_sleep(uint16_t ticks);
-
-#define STACK_BUFFER 64
+uint32_t getTicks();
+uint16_t ms_to_ticks(uint16_t ms);
+uint8_t os_running();
+void set_sample_rate(uint16_t hz);
+uint16_t get_tick_rate();
+uint8_t* heap_end();
+
+//New stacks are filled with this so thread_stack_free() can find the high water mark
+#define STACK_PAINT 0xA5
+//Bytes just below main's stack pointer the gap paint leaves alone
+#define GAP_MARGIN 8
 struct system_t sysInfo;
+struct memory_map memoryMap;
+//Stacks live as long as their threads, which is forever, and each is a
+//different size, so they are cut one after another from a single block
+//instead of coming from the heap
+uint8_t stackArena[OS_STACK_BYTES];
+uint16_t stackArenaUsed = 0;
+uint16_t tickHz = TICK_HZ;
+uint8_t runtimePeriods = 0;
+#ifdef OS_TRACE
+struct trace_record traceRing[OS_TRACE_RECORDS];
+uint8_t traceHead = 0;     //Next record written
+uint8_t traceCount = 0;
+uint8_t traceOn = 1;
+uint8_t traceIdled = TRACE_NONE;   //Thread whose switch to the idle loop is held back
+uint16_t traceIdledAt;
+#endif
 
 //Any OS specific initialization code
 void os_init()
@@ -27,25 +56,122 @@ void os_init()
    sysInfo.curThread = 0;
    sysInfo.numThreads = 0;
    sysInfo.interrupts = 0;
-   sysInfo.runtime = 0;
+   sysInfo.ticks = 0;
+   sysInfo.running = 0;
+   start_runtime_clock();
 }
 
 //Start running the OS
 void os_start()
 {
+   uint8_t* p;
+
+   //main may have turned interrupts on for the runtime clock, the first
+   //tick must not land before the switch away from main's stack
+   cli();
+   //Paint the gap, what is still painted later is what main's stack and
+   //the interrupts on it never reached
+   for(p = heap_end(); p < (uint8_t*)SP - GAP_MARGIN; p++)
+      *p = STACK_PAINT;
    start_system_timer();
+   sysInfo.running = 1;
    //Save the spot after main for infite looping
    struct thread_t loopThread;
    sysInfo.threads[sysInfo.numThreads] = loopThread;
    context_switch(&sysInfo.threads[sysInfo.curThread].stackPtr, &sysInfo.threads[sysInfo.numThreads].stackPtr);
 }
 
+//Returns the first byte above the heap, the heap is empty unless someone
+//calls malloc()
+//__brkval is only weakly referenced so asking about the heap doesn't link
+//malloc() and its 10 bytes of variables into a firmware that never calls it
+uint8_t* heap_end()
+{
+   extern char __heap_start;
+   extern char* __brkval __attribute__((weak));
+
+   return (uint8_t*)(&__brkval && __brkval ? __brkval : &__heap_start);
+}
+
+//Returns the sizes of the SRAM sections and the free gap above the heap.
+//Once running, main's stack is the idle loop's and its pointer is the one
+//saved at the last switch away from it.
+struct memory_map* get_memory_map()
+{
+   extern char __data_start, __data_end, __bss_start, __bss_end, __heap_start;
+   uint8_t* end = heap_end();
+   uint8_t* p;
+   uint16_t sp = sysInfo.running ? sysInfo.threads[sysInfo.numThreads].stackPtr : SP;
+
+   memoryMap.data = &__data_end - &__data_start;
+   memoryMap.bss = &__bss_end - &__bss_start;
+   memoryMap.heap = end - (uint8_t*)&__heap_start;
+   memoryMap.stacks = stackArenaUsed;
+   memoryMap.gap = sp > (uint16_t)end ? sp - (uint16_t)end : 0;
+   if(sysInfo.running)
+   {
+      for(p = end; p < (uint8_t*)sp && *p == STACK_PAINT; p++)
+         ;
+      memoryMap.minGap = p - end;
+   }
+   else
+      memoryMap.minGap = memoryMap.gap;
+   return &memoryMap;
+}
+
 //Returns a pointer to the system info struct
 struct system_t* getSystemInfo()
 {
    return &sysInfo;
 }
 
+//Returns the number of system ticks since the OS started
+uint32_t getTicks()
+{
+   uint32_t ticks;
+   uint8_t sreg = SREG;
+   cli();
+   ticks = sysInfo.ticks;
+   SREG = sreg;
+   return ticks;
+}
+
+//Converts milliseconds to system ticks, rounding up
+uint16_t ms_to_ticks(uint16_t ms)
+{
+   return ((uint32_t)ms * tickHz + 999) / 1000;
+}
+
+//Runs the system tick, and with it the audio output, as close to |hz| as
+//timer 0 allows, never faster than MAX_TICK_HZ
+void set_sample_rate(uint16_t hz)
+{
+   uint32_t compare;
+
+   if(hz > MAX_TICK_HZ)
+      hz = MAX_TICK_HZ;
+   compare = (F_CPU / TICK_PRESCALE + hz / 2) / hz;
+
+   if(compare > 256)
+      compare = 256;
+   if(compare < 2)
+      compare = 2;
+   OCR0A = compare - 1;
+   tickHz = F_CPU / TICK_PRESCALE / compare;
+}
+
+//Returns the current tick rate in Hz
+uint16_t get_tick_rate()
+{
+   return tickHz;
+}
+
+//Returns 1 once the scheduler has been started
+uint8_t os_running()
+{
+   return sysInfo.running;
+}
+
 //Sets the thread state of the given thread to the given state
 void setThreadState(int threadNum, threadState_t state)
 {
@@ -61,75 +187,109 @@ int getCurrentThread()
 //Swaps the 2 given threads
 void threadSwap(int newThread, int oldThread)
 {
+   TRACE_THREADS(oldThread, newThread);
    context_switch(&sysInfo.threads[newThread].stackPtr, &sysInfo.threads[oldThread].stackPtr);
 }
 
 //Puts the current thread to sleep for |tick| interrupts
 void thread_sleep(uint16_t ticks)
 {
-   sysInfo.threads[sysInfo.curThread].state = THREAD_SLEEPING;
-   sysInfo.threads[sysInfo.curThread].sleepCount = ticks;
-   context_switch(&sysInfo.threads[get_next_thread()].stackPtr, 
-      &sysInfo.threads[sysInfo.curThread].stackPtr);
+   cli();
+   int current = sysInfo.curThread;
+   int next;
+   sysInfo.threads[current].state = THREAD_SLEEPING;
+   sysInfo.threads[current].sleepCount = ticks;
+   next = get_next_thread();
+   TRACE_THREADS(current, next);
+   context_switch(&sysInfo.threads[next].stackPtr, 
+      &sysInfo.threads[current].stackPtr);
+   sei();
 }
 
-//The current thread releases the CPU for the next thread
+//The current thread releases the CPU for the next ready thread, or the idle
+//loop if there is none, until the next tick
 void yield()
 {
-   sysInfo.threads[sysInfo.curThread].state = THREAD_READY;
-   while(sysInfo.threads[sysInfo.curThread++].state != THREAD_READY && sysInfo.curThread < sysInfo.numThreads);
+   cli();
+   int current = sysInfo.curThread;
+   int next = current + 1;
+   sysInfo.threads[current].state = THREAD_READY;
+   while(next < sysInfo.numThreads && sysInfo.threads[next].state != THREAD_READY)
+      next++;
 
-   context_switch(&sysInfo.threads[sysInfo.curThread].stackPtr, 
-      &sysInfo.threads[sysInfo.curThread - 1].stackPtr);
+   sysInfo.curThread = next;
+   TRACE_THREADS(current, next);
+   context_switch(&sysInfo.threads[next].stackPtr, 
+      &sysInfo.threads[current].stackPtr);
+   sei();
 }
 
 //The current thread is blocked, let the next go
 void blocked()
 {
-   sysInfo.threads[sysInfo.curThread++].state = THREAD_WAITING;
-
-   context_switch(&sysInfo.threads[sysInfo.curThread].stackPtr, 
-      &sysInfo.threads[sysInfo.curThread - 1].stackPtr);
+   int current = sysInfo.curThread;
+   int next;
+   sysInfo.threads[current].state = THREAD_WAITING;
+
+   //The thread after this one may be asleep too, pick one that can run
+   next = get_next_thread();
+   TRACE_THREADS(current, next);
+   context_switch(&sysInfo.threads[next].stackPtr, 
+      &sysInfo.threads[current].stackPtr);
 }
 
 /* Creates the thread stack for a new thread
  * address - address of the function for this thread
  * args - pointer to function arguments
  * stack_size - size of thread stack in bytes (does not include stack space to save registers)
+ * Returns 1, or 0 if the thread table or the stack block is full
 */
-void create_thread(uint16_t address, void* args, uint16_t stack_size)
+uint8_t create_thread(uint16_t address, void* args, uint16_t stack_size)
 {
    struct thread_t thread;
-   if(sysInfo.numThreads < MAX_THREADS)
-   {
-      thread.id = sysInfo.numThreads;
-      thread.stackSize = stack_size + sizeof(struct regs_context_switch)
-       + sizeof(struct regs_interrupt) + STACK_BUFFER;
-      thread.stackBase = (uint16_t) malloc(thread.stackSize);
-      thread.pcStart = address;
-      thread.state = THREAD_READY;
-      thread.sleepCount = 0;
-      
-      //Set up the stack
-      //Move stack pointer up so theres only room for manual regs and a PC
-      thread.stackPtr = thread.stackBase + thread.stackSize - 1;
-      thread.stackPtr -= sizeof(struct regs_context_switch);
-
-      //PC gets the address of thread start
-      ((struct regs_context_switch *)thread.stackPtr)->pcl = (uint16_t)thread_start & 0xFF;
-      ((struct regs_context_switch *)thread.stackPtr)->pch = ((uint16_t)thread_start & 0xFF00) >> 8;
-
-      //Address in R2:R3
-      ((struct regs_context_switch *)thread.stackPtr)->r2 = address & 0xFF;
-      ((struct regs_context_switch *)thread.stackPtr)->r3 = (address & 0xFF00) >> 8;
-      
-      //Args go in R4:R5
-      ((struct regs_context_switch *)thread.stackPtr)->r4 = (uint16_t)args & 0xFF;
-      ((struct regs_context_switch *)thread.stackPtr)->r5 = ((uint16_t)args & 0xFF00) >> 8;
-
-      sysInfo.threads[sysInfo.numThreads++] = thread;
-   }
-   return;
+   thread.stackSize = THREAD_STACK_BYTES(stack_size);
+   //The last slot is the idle loop's
+   if(sysInfo.numThreads >= MAX_THREADS - 1
+    || thread.stackSize > OS_STACK_BYTES - stackArenaUsed)
+      return 0;
+
+   thread.id = sysInfo.numThreads;
+   thread.stackBase = (uint16_t)&stackArena[stackArenaUsed];
+   stackArenaUsed += thread.stackSize;
+   memset((void*)thread.stackBase, STACK_PAINT, thread.stackSize);
+   thread.state = THREAD_READY;
+   thread.sleepCount = 0;
+   
+   //Set up the stack
+   //Move stack pointer up so theres only room for manual regs and a PC
+   thread.stackPtr = thread.stackBase + thread.stackSize - 1;
+   thread.stackPtr -= sizeof(struct regs_context_switch);
+
+   //PC gets the address of thread start
+   ((struct regs_context_switch *)thread.stackPtr)->pcl = (uint16_t)thread_start & 0xFF;
+   ((struct regs_context_switch *)thread.stackPtr)->pch = ((uint16_t)thread_start & 0xFF00) >> 8;
+
+   //Address in R2:R3
+   ((struct regs_context_switch *)thread.stackPtr)->r2 = address & 0xFF;
+   ((struct regs_context_switch *)thread.stackPtr)->r3 = (address & 0xFF00) >> 8;
+   
+   //Args go in R4:R5
+   ((struct regs_context_switch *)thread.stackPtr)->r4 = (uint16_t)args & 0xFF;
+   ((struct regs_context_switch *)thread.stackPtr)->r5 = ((uint16_t)args & 0xFF00) >> 8;
+
+   sysInfo.threads[sysInfo.numThreads++] = thread;
+   return 1;
+}
+
+//Returns the bytes at the bottom of thread |id|'s stack it has never touched
+uint16_t thread_stack_free(uint8_t id)
+{
+   const uint8_t* p = (const uint8_t*)sysInfo.threads[id].stackBase;
+   uint16_t n = 0;
+
+   while(n < sysInfo.threads[id].stackSize && p[n] == STACK_PAINT)
+      n++;
+   return n;
 }
 
 // Return the id of the next thread to run always thread 0, priority
@@ -146,7 +306,7 @@ uint8_t get_next_thread()
 void updateSleep()
 {
    int i;
-   for(i; i < sysInfo.numThreads; i++)
+   for(i = 0; i < sysInfo.numThreads; i++)
    {
       if(sysInfo.threads[i].state == THREAD_SLEEPING)
       {
@@ -159,6 +319,7 @@ void updateSleep()
 //This interrupt routine is automatically run every 10 milliseconds
 ISR(TIMER0_COMPA_vect) {
    volatile int current = sysInfo.curThread;
+   int next;
    //print_string("Interrupt on ");
    //print_int(current);
    //The following statement tells GCC that it can use registers r18-r27, 
@@ -168,16 +329,167 @@ ISR(TIMER0_COMPA_vect) {
                  "r25", "r26", "r27", "r30", "r31");                        
 
    sysInfo.interrupts++;
+   sysInfo.ticks++;
    updateSleep();
    
    sysInfo.threads[current].state = THREAD_READY;
-   context_switch(&sysInfo.threads[get_next_thread()].stackPtr, 
+   next = get_next_thread();
+   //A tick runs every sample, only the switches it makes are recorded
+   if(next != current)
+      TRACE_THREADS(current, next);
+   context_switch(&sysInfo.threads[next].stackPtr, 
       &sysInfo.threads[current].stackPtr);
 }
 
-//This interrupt routine is run once a second
+//This interrupt routine is run every RUNTIME_PERIOD_MS, runtime counts seconds
 ISR(TIMER1_COMPA_vect) {
-   sysInfo.runtime++;
+   TRACE(TRACE_ISR_ENTER, TRACE_ISR_RUNTIME);
+   if(++runtimePeriods == 1000 / RUNTIME_PERIOD_MS)
+   {
+      runtimePeriods = 0;
+      sysInfo.runtime++;
+   }
+   TRACE(TRACE_ISR_EXIT, TRACE_ISR_RUNTIME);
+}
+
+#ifdef OS_TRACE
+//Writes a record stamped |time| at the head of the ring, interrupts must be off
+void trace_record_at(uint16_t time, uint8_t event, uint8_t arg)
+{
+   struct trace_record* r = &traceRing[traceHead];
+
+   r->time = time;
+   r->event = event;
+   r->arg = arg;
+   if(++traceHead == OS_TRACE_RECORDS)
+      traceHead = 0;
+   if(traceCount < OS_TRACE_RECORDS)
+      traceCount++;
+}
+
+//Records |event| with |arg| in the trace ring, overwriting the oldest record
+//Safe from threads and interrupt routines
+void os_trace(uint8_t event, uint8_t arg)
+{
+   uint8_t sreg = SREG;
+
+   cli();
+   if(traceOn)
+   {
+      //A held back switch happened first, keep the stamps in order
+      if(traceIdled != TRACE_NONE)
+      {
+         trace_record_at(traceIdledAt, TRACE_SWITCH, traceIdled << 4 | sysInfo.numThreads);
+         traceIdled = TRACE_NONE;
+      }
+      trace_record_at(TCNT1, event, arg);
+   }
+   SREG = sreg;
+}
+
+//Records a switch from thread |from| to thread |to|
+//The player yields to the idle loop every sample and the next tick switches
+//straight back, so a switch to the idle loop is held back and the pair is
+//dropped when the same thread comes back with nothing recorded in between
+void os_trace_switch(uint8_t from, uint8_t to)
+{
+   uint8_t sreg = SREG;
+
+   cli();
+   if(to == sysInfo.numThreads)
+   {
+      traceIdled = from;
+      traceIdledAt = TCNT1;
+   }
+   else if(from == sysInfo.numThreads && to == traceIdled)
+      traceIdled = TRACE_NONE;
+   else
+      os_trace(TRACE_SWITCH, from << 4 | to);
+   SREG = sreg;
+}
+
+//Stops recording so the ring keeps what led up to now
+void os_trace_freeze()
+{
+   traceOn = 0;
+}
+
+//Moves up to |max| of the oldest records to |out|, returns how many
+//Only call it with the trace frozen
+uint8_t os_trace_take(struct trace_record* out, uint8_t max)
+{
+   uint8_t n = 0;
+   uint8_t tail;
+
+   while(n < max && traceCount)
+   {
+      tail = traceHead >= traceCount ? traceHead - traceCount
+         : traceHead + OS_TRACE_RECORDS - traceCount;
+      out[n++] = traceRing[tail];
+      traceCount--;
+   }
+   return n;
+}
+
+//Empties the ring and records again
+void os_trace_restart()
+{
+   uint8_t sreg = SREG;
+
+   cli();
+   traceHead = 0;
+   traceCount = 0;
+   traceIdled = TRACE_NONE;
+   traceOn = 1;
+   SREG = sreg;
+}
+#endif
+
+//Start timer 1, the runtime clock, it doubles as a fine grained cycle counter
+//main starts it first thing to time the boot, os_init starts it otherwise
+void start_runtime_clock() {
+   if(TIMSK1 & _BV(OCIE1A))
+      return;
+   OCR1A = RUNTIME_COMPARE;
+   TIMSK1 |= _BV(OCIE1A);  /* IRQ on compare.  */
+   TCCR1B |= _BV(WGM12) | _BV(CS11); //prescalar /8
+}
+
+//Returns microseconds since the runtime clock started
+//Interrupts have to be on for it to count past one RUNTIME_PERIOD_MS
+uint32_t os_micros()
+{
+   uint32_t seconds;
+   uint8_t periods;
+   uint16_t count;
+   uint8_t sreg = SREG;
+
+   cli();
+   seconds = sysInfo.runtime;
+   periods = runtimePeriods;
+   count = TCNT1;
+   //The timer wrapped and the interrupt hasn't run yet
+   if((TIFR1 & _BV(OCF1A)) && count < RUNTIME_COMPARE / 2)
+      periods++;
+   SREG = sreg;
+   return seconds * 1000000 + (uint32_t)periods * RUNTIME_PERIOD_MS * 1000
+      + count / (F_CPU / CYCLES_PER_COUNT / 1000000);
+}
+
+//Returns a timestamp for cycles_since()
+uint16_t cycle_stamp()
+{
+   return TCNT1;
+}
+
+//Returns the CPU cycles since |stamp|, to a resolution of CYCLES_PER_COUNT
+//Only valid for spans shorter than RUNTIME_PERIOD_MS
+uint32_t cycles_since(uint16_t stamp)
+{
+   uint16_t now = TCNT1;
+   if(now < stamp)
+      now += RUNTIME_COMPARE + 1;
+   return (uint32_t)(now - stamp) * CYCLES_PER_COUNT;
 }
 
 //New start system timer for program 5
@@ -185,14 +497,9 @@ void start_system_timer() {
    TIMSK0 |= _BV(OCIE0A);  /* IRQ on compare.  */
    TCCR0A |= _BV(WGM01); //clear timer on compare match
 
-   //22KHz settings
-   TCCR0B |= _BV(CS01) | _BV(CS01); //slowest prescalar /1024
-   OCR0A = 180; 
-
-   //start timer 1 to generate interrupt every 1 second
-   OCR1A = 15625;
-   TIMSK1 |= _BV(OCIE1A);  /* IRQ on compare.  */
-   TCCR1B |= _BV(WGM12) | _BV(CS12) | _BV(CS10); //slowest prescalar /1024
+   //~11KHz settings, see TICK_HZ
+   TCCR0B |= _BV(CS01); //prescalar /8
+   OCR0A = TICK_COMPARE; 
 }
 
 //Start pulse wave modulation
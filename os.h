@@ -2,7 +2,75 @@
 #define OS_H
 #include "stdint.h"
 
-#define MAX_THREADS 8
+//Threads main() creates plus the idle loop, each one costs a slot in every
+//mutex and semaphore as well as in the thread table
+#define MAX_THREADS 4
+
+//System tick, timer 0 in CTC mode
+//The player outputs one sample per tick, so this is also the sample clock
+#define TICK_PRESCALE 8
+#define TICK_COMPARE 180 //default rate before any song sets one
+#define TICK_HZ (F_CPU / TICK_PRESCALE / (TICK_COMPARE + 1))
+//Fastest tick set_sample_rate() runs, 725 cycles a tick at 16 MHz.  Every
+//tick mixes a sample, up to MIX_CYCLE_BUDGET cycles in the makefile, on top
+//of the interrupt and the jitter histogram, at 44.1 kHz that would leave the
+//loader too little of the CPU.  Faster PCM songs are decimated to fit, see
+//wavOpen(), and faster ADPCM songs are refused.
+#define MAX_TICK_HZ 22050
+
+//Runtime clock, timer 1 in CTC mode
+#define CYCLES_PER_COUNT 8 //timer 1 prescaler, 0.5us per count
+#define RUNTIME_PERIOD_MS 25 //a period must fit in 16 bits of counts
+#define RUNTIME_COMPARE (F_CPU / CYCLES_PER_COUNT / 1000 * RUNTIME_PERIOD_MS - 1)
+#define COUNTS_TO_US(c) ((uint32_t)(c) * CYCLES_PER_COUNT / (F_CPU / 1000000))
+
+//Kernel event trace, build with -DOS_TRACE to record
+//Each record is stamped with timer 1, CYCLES_PER_COUNT cycles per count,
+//which wraps every RUNTIME_PERIOD_MS.  Records are close enough together that
+//a reader can unwrap them by adding a period whenever the stamp goes back.
+#ifndef OS_TRACE_RECORDS
+#define OS_TRACE_RECORDS 64
+#endif
+
+enum trace_event {
+   TRACE_SWITCH,           //arg: old thread << 4 | new thread
+   TRACE_ISR_ENTER,        //arg: trace_isr
+   TRACE_ISR_EXIT,
+   TRACE_MUTEX_BLOCK,      //arg: thread that blocked
+   TRACE_MUTEX_WAKE,       //arg: thread handed the mutex
+   TRACE_SEM_BLOCK,        //arg: thread that blocked
+   TRACE_SEM_SIGNAL,       //arg: thread woken, TRACE_NONE if nobody was waiting
+   TRACE_SD_COMMAND,       //arg: command index
+   TRACE_SD_RESPONSE,      //arg: R1
+   TRACE_SD_DATA,          //arg: 0, a read's data phase finished
+   TRACE_UNDERRUN,         //arg: 0, the player found nothing to play, recording stops
+   TRACE_EVENTS
+};
+
+enum trace_isr {
+   TRACE_ISR_TICK,         //Not recorded, only the switches ticks make
+   TRACE_ISR_RUNTIME,
+   TRACE_ISR_UART_RX,
+   TRACE_ISR_UART_TX
+};
+
+#define TRACE_NONE 0xFF
+
+struct trace_record {
+   uint16_t time;          //Timer 1 count
+   uint8_t event;
+   uint8_t arg;
+};
+
+#ifdef OS_TRACE
+#define TRACE(event, arg) os_trace(event, arg)
+#define TRACE_THREADS(from, to) os_trace_switch(from, to)
+#define TRACE_FREEZE() os_trace_freeze()
+#else
+#define TRACE(event, arg)
+#define TRACE_THREADS(from, to)
+#define TRACE_FREEZE()
+#endif
 
 //This structure defines the register order pushed to the stack on a
 //system context switch.
@@ -59,6 +127,19 @@ struct regs_interrupt {
    uint8_t pcl;
 };
 
+//Bytes past its own needs that every thread stack gets for an interrupt to
+//land on it while it runs
+#define STACK_BUFFER 32
+//Stack for a thread that needs |n| bytes itself, with room to save its
+//registers and for an interrupt
+#define THREAD_STACK_BYTES(n) ((n) + sizeof(struct regs_context_switch) \
+   + sizeof(struct regs_interrupt) + STACK_BUFFER)
+//Thread stacks are cut from one static block of this size, main() checks
+//at compile time that its threads fit
+#ifndef OS_STACK_BYTES
+#define OS_STACK_BYTES 765
+#endif
+
 typedef enum {
    THREAD_RUNNING,
    THREAD_WAITING,
@@ -66,21 +147,58 @@ typedef enum {
    THREAD_READY,
 }threadState_t;
 
+//Ids, counts and states are bytes, every int here is two bytes of SRAM
+//per thread
 struct thread_t {
-   int id;
-   int pcStart;
+   uint8_t id;
    int stackSize;
    uint16_t stackPtr;
    uint16_t stackBase;
-   threadState_t state;
+   uint8_t state;          //threadState_t
    int sleepCount;
 };
 
 struct system_t {
    struct thread_t threads[MAX_THREADS];
-   int curThread;
-   int numThreads;
+   uint8_t curThread;
+   uint8_t numThreads;
    uint16_t interrupts;
    uint16_t runtime;
+   uint32_t ticks;
+   uint8_t running;
 };
+
+//Where the SRAM went, in bytes.  The thread stacks are part of the bss,
+//each thread's own region is stackBase and stackSize in its thread_t.
+struct memory_map {
+   uint16_t data;
+   uint16_t bss;
+   uint16_t heap;
+   uint16_t stacks;        //Of the bss, handed out as thread stacks
+   uint16_t gap;           //Free between the heap and main's stack now
+   uint16_t minGap;        //The least it has been since os_start()
+};
+
+uint8_t create_thread(uint16_t address, void* args, uint16_t stack_size);
+struct system_t* getSystemInfo();
+struct memory_map* get_memory_map();
+uint32_t getTicks();
+uint16_t ms_to_ticks(uint16_t ms);
+void set_sample_rate(uint16_t hz);
+uint16_t get_tick_rate();
+uint8_t os_running();
+void start_runtime_clock();
+uint32_t os_micros();
+uint16_t cycle_stamp();
+uint32_t cycles_since(uint16_t stamp);
+void thread_sleep(uint16_t ticks);
+void yield();
+uint16_t thread_stack_free(uint8_t id);
+#ifdef OS_TRACE
+void os_trace(uint8_t event, uint8_t arg);
+void os_trace_switch(uint8_t from, uint8_t to);
+void os_trace_freeze();
+uint8_t os_trace_take(struct trace_record* out, uint8_t max);
+void os_trace_restart();
+#endif
 #endif
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include <avr/interrupt.h>
+#include "readahead.h"
+#include "syncro.h"
+#include "os.h"
+
+struct ra_block raBlocks[READAHEAD_BLOCKS];
+semaphore_t raFilled;
+uint8_t raHead;        //Next block the loader fills
+uint8_t raTail;        //Next block the player reads
+uint8_t raFastFills;
+uint32_t raFillStart;
+struct readahead_stats raStats;
+
+//Sets up an empty ring, call before the threads start
+void raInit()
+{
+   sem_init(&raFilled, 0);
+   raHead = 0;
+   raTail = 0;
+   raFastFills = 0;
+   raStats.depth = 0;
+   raStats.target = READAHEAD_MIN_DEPTH;
+   raStats.minDepth = READAHEAD_BLOCKS;
+   raStats.stalls = 0;
+   raStats.slowReads = 0;
+   raStats.maxLatency = 0;
+   raStats.stallTicks = 0;
+   raStats.fills = 0;
+   raStats.totalLatency = 0;
+}
+
+//Returns the next block for the loader to fill
+//Sleeps while the ring is already |target| blocks ahead of the player
+struct ra_block* raWriteBlock()
+{
+   while(raStats.depth >= raStats.target)
+      thread_sleep(READAHEAD_POLL_TICKS);
+   raFillStart = getTicks();
+   return &raBlocks[raHead];
+}
+
+//Hands the block from raWriteBlock() to the player
+//Slow refills push the target depth up, a run of fast ones lets it back down
+void raCommitBlock()
+{
+   uint16_t latency = getTicks() - raFillStart;
+
+   if(latency > raStats.maxLatency)
+      raStats.maxLatency = latency;
+   raStats.fills++;
+   raStats.totalLatency += latency;
+   if(latency > READAHEAD_SLOW_TICKS)
+   {
+      raStats.slowReads++;
+      raFastFills = 0;
+      if(raStats.target < READAHEAD_BLOCKS)
+         raStats.target++;
+   }
+   else if(++raFastFills >= READAHEAD_SETTLE)
+   {
+      raFastFills = 0;
+      if(raStats.target > READAHEAD_MIN_DEPTH)
+         raStats.target--;
+   }
+
+   raHead = (raHead + 1) % READAHEAD_BLOCKS;
+   cli();
+   raStats.depth++;
+   sei();
+   sem_signal(&raFilled);
+}
+
+//Returns the next filled block, blocking the player if the loader is behind
+struct ra_block* raReadBlock()
+{
+   uint32_t start;
+   uint8_t stalled;
+
+   cli();
+   if(raStats.depth < raStats.minDepth)
+      raStats.minDepth = raStats.depth;
+   stalled = !raStats.depth;
+   if(stalled)
+   {
+      raStats.stalls++;
+      start = getTicks();
+      //Before the first fill this is just the boot, keep tracing
+      if(raStats.fills)
+      {
+         TRACE(TRACE_UNDERRUN, 0);
+         TRACE_FREEZE();
+      }
+   }
+   sei();
+   sem_wait(&raFilled);
+   if(stalled)
+      raStats.stallTicks += getTicks() - start;
+   return &raBlocks[raTail];
+}
+
+//Gives the block from raReadBlock() back to the loader
+void raReleaseBlock()
+{
+   raTail = (raTail + 1) % READAHEAD_BLOCKS;
+   cli();
+   raStats.depth--;
+   sei();
+}
+
+//Returns a pointer to the readahead counters
+struct readahead_stats* getReadaheadStats()
+{
+   return &raStats;
+}
@@ -0,0 +1,44 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+#include <stdint.h>
+#include "globals.h"
+
+//Blocks in the ring between the loader and the player
+#ifndef READAHEAD_BLOCKS
+#define READAHEAD_BLOCKS 4
+#endif
+//Fewest blocks the loader keeps filled
+#define READAHEAD_MIN_DEPTH 2
+//A refill taking longer than this many ticks counts as the card slowing down
+#define READAHEAD_SLOW_TICKS (BUFFER_SIZE / 2)
+//Fast refills in a row before the loader stops reaching as far ahead
+#define READAHEAD_SETTLE 64
+//How long the loader sleeps when it is far enough ahead
+#define READAHEAD_POLL_TICKS (BUFFER_SIZE / 4)
+
+struct ra_block {
+   uint8_t data[BUFFER_SIZE];
+   uint16_t len;
+   uint16_t rate;          //Sample rate of the song the block came from
+};
+
+struct readahead_stats {
+   uint8_t depth;          //Blocks filled and not yet released, includes the one playing
+   uint8_t target;         //Depth the loader currently keeps
+   uint8_t minDepth;       //Lowest depth the player has seen
+   uint16_t stalls;        //Times the player found nothing to play
+   uint16_t slowReads;     //Refills slower than READAHEAD_SLOW_TICKS
+   uint16_t maxLatency;    //Longest refill in ticks
+   uint32_t stallTicks;    //Ticks the player spent waiting on the loader
+   uint32_t fills;         //Blocks committed
+   uint32_t totalLatency;  //Ticks spent filling them, over fills is the mean
+};
+
+void raInit();
+struct ra_block* raWriteBlock();
+void raCommitBlock();
+struct ra_block* raReadBlock();
+void raReleaseBlock();
+struct readahead_stats* getReadaheadStats();
+
+#endif
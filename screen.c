@@ -0,0 +1,210 @@
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "screen.h"
+#include "serial.h"
+#include "globals.h"
+
+#define ESC 27
+//Hash of the empty string, what text_hash() starts from
+#define HASH_EMPTY 5381
+
+//The screen keeps only what it needs to diff against: the last value of each
+//number field, or a hash of the last string for text fields.  Numbers are
+//rendered again from the old value and only the characters that differ are
+//sent.
+static const struct screen_field* layout;
+static uint32_t* drawn;
+static uint8_t fieldCount;
+static uint8_t cursorRow;
+static uint8_t cursorCol;
+static uint32_t bytesSent;
+
+static void put(uint8_t c);
+static void put_decimal(uint8_t n);
+static void move_to(uint8_t row, uint8_t col);
+static void put_string_at(uint8_t row, uint8_t col, const char* s, uint8_t len);
+static void render(uint32_t value, char* out, uint8_t width);
+static void field_at(uint8_t field, struct screen_field* f);
+static uint32_t text_hash(char* s);
+
+//Sends one byte, callers keep track of where the cursor went
+static void put(uint8_t c)
+{
+   write_byte(c);
+   bytesSent++;
+}
+
+//Sends a decimal number without padding
+static void put_decimal(uint8_t n)
+{
+   if(n >= 100)
+      put('0' + n / 100);
+   if(n >= 10)
+      put('0' + n / 10 % 10);
+   put('0' + n % 10);
+}
+
+//Moves the cursor unless it is already at |row|, |col|
+static void move_to(uint8_t row, uint8_t col)
+{
+   if(row == cursorRow && col == cursorCol)
+      return;
+   //<ESC>[{ROW};{COLUMN}H
+   put(ESC);
+   put('[');
+   put_decimal(row);
+   put(';');
+   put_decimal(col);
+   put('H');
+   cursorRow = row;
+   cursorCol = col;
+}
+
+//Writes |len| characters of flash string |s| at |row|, |col|
+static void put_string_at(uint8_t row, uint8_t col, const char* s, uint8_t len)
+{
+   move_to(row, col);
+   while(len--)
+   {
+      put(pgm_read_byte(s++));
+      cursorCol++;
+   }
+}
+
+//Copies the layout of |field| out of flash
+static void field_at(uint8_t field, struct screen_field* f)
+{
+   memcpy_P(f, &layout[field], sizeof(*f));
+}
+
+//Right aligns |value| in |width| characters, all '#' when it does not fit
+static void render(uint32_t value, char* out, uint8_t width)
+{
+   char digits[SCREEN_NUMBER_WIDTH];
+   uint8_t n = format_decimal(value, digits);
+
+   if(n > width)
+   {
+      memset(out, '#', width);
+      return;
+   }
+   memset(out, ' ', width - n);
+   memcpy(out + width - n, digits, n);
+}
+
+//Cheap hash to notice a string changed without keeping a copy
+static uint32_t text_hash(char* s)
+{
+   uint32_t hash = HASH_EMPTY;
+
+   while(*s)
+      hash = hash * 33 + (uint8_t)*s++;
+   return hash;
+}
+
+//Clears the terminal and draws the labels of |count| fields from |fields|.
+//|labels| has one label per field, in order, each ended by a '\0', an empty
+//one for no label.  Both are in flash.  |shadow| holds one word per field
+//and must live as long as the screen.
+void screen_init(const struct screen_field* fields, const char* labels,
+   uint32_t* shadow, uint8_t count)
+{
+   struct screen_field f;
+   uint8_t i, j, len;
+
+   layout = fields;
+   drawn = shadow;
+   fieldCount = count;
+
+   put(ESC);
+   put('[');
+   put('2');
+   put('J');
+   //Unknown until the first move
+   cursorRow = 0;
+   cursorCol = 0;
+   put(ESC);
+   put('[');
+   put_decimal(GREEN);
+   put('m');
+
+   //Every field starts out showing 0 or an empty string
+   for(i = 0; i < count; i++)
+   {
+      field_at(i, &f);
+      len = strlen_P(labels);
+      if(len)
+         put_string_at(f.row, f.col - len, labels, len);
+      labels += len + 1;
+      if(f.width <= SCREEN_NUMBER_WIDTH)
+      {
+         move_to(f.row, f.col + f.width - 1);
+         put('0');
+         cursorCol++;
+         shadow[i] = 0;
+      }
+      else
+      {
+         move_to(f.row, f.col);
+         for(j = 0; j < f.width; j++)
+            put(' ');
+         cursorCol += f.width;
+         shadow[i] = HASH_EMPTY;
+      }
+   }
+}
+
+//Shows |value| in number field |field|, sending only the digits that changed
+void screen_number(uint8_t field, uint32_t value)
+{
+   struct screen_field f;
+   char was[SCREEN_NUMBER_WIDTH];
+   char now[SCREEN_NUMBER_WIDTH];
+   uint8_t i;
+
+   if(field >= fieldCount || drawn[field] == value)
+      return;
+   field_at(field, &f);
+   render(drawn[field], was, f.width);
+   render(value, now, f.width);
+   for(i = 0; i < f.width; i++)
+   {
+      if(was[i] == now[i])
+         continue;
+      move_to(f.row, f.col + i);
+      put(now[i]);
+      cursorCol++;
+   }
+   drawn[field] = value;
+}
+
+//Shows |s| in text field |field|, cut or blank padded to its width.  Only
+//the hash of the old string is kept, so a change redraws the whole field.
+void screen_text(uint8_t field, char* s)
+{
+   struct screen_field f;
+   uint32_t hash = text_hash(s);
+   uint8_t i;
+
+   if(field >= fieldCount || drawn[field] == hash)
+      return;
+   field_at(field, &f);
+   move_to(f.row, f.col);
+   for(i = 0; i < f.width; i++)
+      put(*s ? *s++ : ' ');
+   cursorCol += f.width;
+   drawn[field] = hash;
+}
+
+//Someone else moved the cursor, the next draw has to position it
+void screen_cursor_lost()
+{
+   cursorRow = 0;
+   cursorCol = 0;
+}
+
+//Returns the bytes the screen has sent to the terminal
+uint32_t screen_bytes()
+{
+   return bytesSent;
+}
@@ -0,0 +1,23 @@
+#ifndef SCREEN_H
+#define SCREEN_H
+#include <stdint.h>
+
+//Widest number field, enough for any 32-bit value, numbers are right aligned
+#define SCREEN_NUMBER_WIDTH 10
+
+//One value on the terminal, rows and columns are 1 based like the terminal's
+//The layout is kept in flash, with the labels in one string beside it
+struct screen_field {
+   uint8_t row;
+   uint8_t col;            //First column of the value, its label ends just before
+   uint8_t width;          //Columns the value owns, wider than SCREEN_NUMBER_WIDTH is text
+};
+
+void screen_init(const struct screen_field* fields, const char* labels,
+   uint32_t* shadow, uint8_t count);
+void screen_number(uint8_t field, uint32_t value);
+void screen_text(uint8_t field, char* s);
+void screen_cursor_lost();
+uint32_t screen_bytes();
+
+#endif
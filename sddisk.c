@@ -0,0 +1,31 @@
+#include "blockdev.h"
+#include "SdReader.h"
+#include "os.h"
+
+uint8_t sdDiskRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count);
+uint8_t sdDiskGeometry(struct block_device* dev, struct blockdev_geometry* geo);
+
+struct block_device sdDisk = {sdDiskRead, 0, sdDiskGeometry};
+
+//Returns the block device for the SD card, sdInit() must have succeeded
+struct block_device* sdDevice()
+{
+   return &sdDisk;
+}
+
+uint8_t sdDiskRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count)
+{
+   //Threads sleep through the data phase, before the OS starts poll for it
+   if(os_running())
+      return sdReadDataSleep(sector, offset, dst, count);
+   return sdReadData(sector, offset, dst, count);
+}
+
+uint8_t sdDiskGeometry(struct block_device* dev, struct blockdev_geometry* geo)
+{
+   geo->sectors = sdCardSize();
+   geo->sectorSize = BLOCKDEV_SECTOR_SIZE;
+   return geo->sectors != 0;
+}
@@ -1,9 +1,40 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdarg.h>
+#ifdef SERIAL_BENCHMARK
 #include <stdio.h>
+#endif
+#include "serial.h"
+#include "syncro.h"
 
 #define ESC  27
 #define BYTE 8
 
+#define TX_MASK (SERIAL_TX_SIZE - 1)
+#define RX_MASK (SERIAL_RX_SIZE - 1)
+
+//Rings between the threads and the USART interrupts, head is written by the
+//producer and tail by the consumer.  Indices run free and wrap with the mask
+//so a full ring is head - tail == size.
+static uint8_t txRing[SERIAL_TX_SIZE];
+static volatile uint8_t txHead;
+static volatile uint8_t txTail;
+static uint8_t rxRing[SERIAL_RX_SIZE];
+static volatile uint8_t rxHead;
+static volatile uint8_t rxTail;
+
+//Blocked readers sleep here and one is woken per byte received, a blocked
+//writer is woken once the transmit ring is down to half full
+static semaphore_t txRoom;
+static semaphore_t rxReady;
+static volatile uint8_t txWaiting;
+static volatile uint8_t rxWaiting;
+static struct serial_stats stats;
+
+static void tx_send();
+static void rx_store(uint8_t b);
+
 /*
  * Initialize the serial port.
  */
@@ -17,40 +48,170 @@ void serial_init() {
    UBRR0H = baud_setting >> 8;
    UBRR0L = baud_setting;
 
-   // enable transmit and receive
-   UCSR0B |= (1 << TXEN0) | (1 << RXEN0);
+   sem_init(&txRoom, 0);
+   sem_init(&rxReady, 0);
+
+   // enable transmit and receive, the transmit interrupt goes on with data
+   UCSR0B |= (1 << TXEN0) | (1 << RXEN0) | (1 << RXCIE0);
+}
+
+//Moves one queued byte to the transmitter, which must be ready for it
+static void tx_send()
+{
+   UDR0 = txRing[txTail & TX_MASK];
+   txTail++;
+   if(txTail == txHead)
+      UCSR0B &= ~_BV(UDRIE0);
+}
+
+//Keeps |b| if the ring has room, interrupts must be off
+static void rx_store(uint8_t b)
+{
+   if((uint8_t)(rxHead - rxTail) == SERIAL_RX_SIZE)
+   {
+      stats.rxDropped++;
+      return;
+   }
+   rxRing[rxHead & RX_MASK] = b;
+   rxHead++;
+   if(rxWaiting)
+   {
+      rxWaiting--;
+      sem_signal_isr(&rxReady);
+   }
+}
+
+//Transmitter ready for the next byte
+ISR(USART_UDRE_vect)
+{
+   TRACE(TRACE_ISR_ENTER, TRACE_ISR_UART_TX);
+   tx_send();
+   if(txWaiting && (uint8_t)(txHead - txTail) <= SERIAL_TX_SIZE / 2)
+   {
+      txWaiting--;
+      sem_signal_isr(&txRoom);
+   }
+   TRACE(TRACE_ISR_EXIT, TRACE_ISR_UART_TX);
+}
+
+//A byte arrived
+ISR(USART_RX_vect)
+{
+   TRACE(TRACE_ISR_ENTER, TRACE_ISR_UART_RX);
+   rx_store(UDR0);
+   TRACE(TRACE_ISR_EXIT, TRACE_ISR_UART_RX);
 }
 
 /*
  * Return 1 if a character is available else return 0.
  */
 uint8_t byte_available() {
-   return (UCSR0A & (1 << RXC0)) ? 1 : 0;
+   return rxHead != rxTail;
 }
 
 /*
- * Unbuffered read
+ * Buffered read, never waits
  * Return 255 if no character is available otherwise return available character.
  */
 uint8_t read_byte() {
-   if (UCSR0A & (1 << RXC0)) return UDR0;
-   return 255;
+   uint8_t b;
+
+   if(rxHead == rxTail)
+      return 255;
+   b = rxRing[rxTail & RX_MASK];
+   rxTail++;
+   return b;
 }
 
 /*
- * Unbuffered write
+ * Buffered read, sleeps until a character arrives
+ */
+uint8_t read_byte_wait() {
+   uint8_t sreg = SREG;
+
+   cli();
+   while(rxHead == rxTail)
+   {
+      //Before the scheduler runs nothing can sleep, poll the receiver instead
+      if(os_running())
+      {
+         rxWaiting++;
+         sem_wait(&rxReady);
+         cli();
+      }
+      else if(UCSR0A & _BV(RXC0))
+         rx_store(UDR0);
+   }
+   SREG = sreg;
+   return read_byte();
+}
+
+/*
+ * Buffered write, never waits
+ * Return 0 if the transmit ring is full.
+ */
+uint8_t try_write_byte(uint8_t b) {
+   uint8_t sreg = SREG;
+
+   cli();
+   if((uint8_t)(txHead - txTail) == SERIAL_TX_SIZE)
+   {
+      SREG = sreg;
+      return 0;
+   }
+   txRing[txHead & TX_MASK] = b;
+   txHead++;
+   UCSR0B |= _BV(UDRIE0);
+   SREG = sreg;
+   return 1;
+}
+
+/*
+ * Buffered write, sleeps while the transmit ring is full
  *
  * b byte to write.
  */
 uint8_t write_byte(uint8_t b) {
-   //loop until the send buffer is empty
-   while (((1 << UDRIE0) & UCSR0B) || !(UCSR0A & (1 << UDRE0))) {}
+   uint8_t sreg;
 
-   //write out the byte
-   UDR0 = b;
+   if(try_write_byte(b))
+      return 1;
+
+   sreg = SREG;
+   cli();
+   stats.txWaits++;
+   while((uint8_t)(txHead - txTail) == SERIAL_TX_SIZE)
+   {
+      //Before the scheduler runs, or when the caller had interrupts off, drain
+      //by polling, sleeping there would never be woken
+      if(os_running() && (sreg & _BV(SREG_I)))
+      {
+         txWaiting++;
+         sem_wait(&txRoom);
+         cli();
+      }
+      else if(UCSR0A & _BV(UDRE0))
+         tx_send();
+   }
+   txRing[txHead & TX_MASK] = b;
+   txHead++;
+   UCSR0B |= _BV(UDRIE0);
+   SREG = sreg;
    return 1;
 }
 
+//Returns how many bytes can be queued without waiting
+uint8_t serial_tx_free()
+{
+   return SERIAL_TX_SIZE - (uint8_t)(txHead - txTail);
+}
+
+//Returns the serial counters
+struct serial_stats* get_serial_stats()
+{
+   return &stats;
+}
+
 //Print a string
 void print_string(char* s)
 {
@@ -59,58 +220,233 @@ void print_string(char* s)
    return;
 }
 
-//Print an 8-bit or 16-bit unsigned integer
-void print_int(uint16_t i) 
+//Print a string kept in flash, use PSTR("...")
+void print_string_P(const char* s)
 {
-   char str[10];
-   sprintf(str, "%u", i);
-   print_string(str);
+   char c;
+   while((c = pgm_read_byte(s++)))
+      write_byte(c);
 }
 
-//Print a 32-bit unsigned integer
-void print_int32(uint32_t i) {
-   char buf[32] = {0};
-   int ndx = 31;
+//Powers of ten for digit generation by subtraction, the AVR has no divide
+static const uint32_t powersOfTen[] PROGMEM = {
+   1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL, 10000UL, 1000, 100, 10
+};
 
-   write_byte(0x1B);
-   write_byte('[');
-   write_byte('1');
-   write_byte('i');
+//Writes |value| in decimal at |out| without leading zeros, at most 10
+//characters and no terminator.  Returns the number written.
+uint8_t format_decimal(uint32_t value, char* out)
+{
+   uint8_t i = 0, n = 0;
+   uint32_t power;
+   char digit;
 
-   for (; i && ndx; --ndx, i /= 10)
-      buf[ndx] = "0123456789"[i % 10];
+   //Skip the powers above the value with one compare each
+   while(i < sizeof(powersOfTen) / sizeof(powersOfTen[0])
+         && value < pgm_read_dword(&powersOfTen[i]))
+      i++;
+   for(; i < sizeof(powersOfTen) / sizeof(powersOfTen[0]); i++)
+   {
+      power = pgm_read_dword(&powersOfTen[i]);
+      digit = '0';
+      while(value >= power)
+      {
+         value -= power;
+         digit++;
+      }
+      out[n++] = digit;
+   }
+   out[n++] = '0' + value;
+   return n;
+}
 
-   while (ndx <= 31) write_byte(buf[ndx++]);
-   return;
+//Writes |value| in lower case hex at |out| without leading zeros, at most 8
+//characters and no terminator.  Returns the number written.
+uint8_t format_hex(uint32_t value, char* out)
+{
+   uint8_t shift = 28, n = 0, nibble;
+
+   while(shift && !(value >> shift & 0xF))
+      shift -= 4;
+   while(1)
+   {
+      nibble = value >> shift & 0xF;
+      out[n++] = nibble < 10 ? '0' + nibble : 'a' - 10 + nibble;
+      if(!shift)
+         return n;
+      shift -= 4;
+   }
+}
+
+//Writes |count| copies of |c|
+static void pad(int8_t count, char c)
+{
+   while(count-- > 0)
+      write_byte(c);
+}
+
+/*
+ * printf for the console with the format string in flash, use PSTR("...").
+ * Understands %u %d %x %c %s, %S for a string in flash and %%.  A width may
+ * come first, with a leading 0 to pad numbers with zeros (strings are padded
+ * on the right), and an l for 32-bit values.
+ * Everything goes straight into the transmit ring.
+ */
+void print_fmt_P(const char* fmt, ...)
+{
+   va_list args;
+   char digits[10];
+   char c, fill;
+   const char* s;
+   int8_t width;
+   uint8_t isLong, n, negative;
+   uint32_t value;
+
+   va_start(args, fmt);
+   while((c = pgm_read_byte(fmt++)))
+   {
+      if(c != '%')
+      {
+         write_byte(c);
+         continue;
+      }
+      c = pgm_read_byte(fmt++);
+      fill = ' ';
+      if(c == '0')
+      {
+         fill = '0';
+         c = pgm_read_byte(fmt++);
+      }
+      width = 0;
+      while(c >= '0' && c <= '9')
+      {
+         width = width * 10 + c - '0';
+         c = pgm_read_byte(fmt++);
+      }
+      isLong = c == 'l';
+      if(isLong)
+         c = pgm_read_byte(fmt++);
+
+      switch(c)
+      {
+         case 'd':
+         case 'u':
+         case 'x':
+            value = isLong ? va_arg(args, uint32_t) : va_arg(args, unsigned int);
+            negative = 0;
+            if(c == 'd')
+            {
+               if(!isLong)
+                  value = (int32_t)(int)value;
+               if((int32_t)value < 0)
+               {
+                  value = -value;
+                  negative = 1;
+                  width--;
+               }
+            }
+            n = c == 'x' ? format_hex(value, digits) : format_decimal(value, digits);
+            //The sign goes before zeros but after blanks
+            if(negative && fill == '0')
+               write_byte('-');
+            pad(width - n, fill);
+            if(negative && fill == ' ')
+               write_byte('-');
+            for(width = 0; width < n; width++)
+               write_byte(digits[width]);
+            break;
+         case 'c':
+            write_byte(va_arg(args, int));
+            break;
+         case 's':
+            s = va_arg(args, const char*);
+            for(n = 0; s[n]; n++)
+               write_byte(s[n]);
+            pad(width - n, ' ');
+            break;
+         case 'S':
+            s = va_arg(args, const char*);
+            for(n = 0; (c = pgm_read_byte(s + n)); n++)
+               write_byte(c);
+            pad(width - n, ' ');
+            break;
+         case '%':
+            write_byte('%');
+            break;
+         default:
+            //An unknown conversion ends the output rather than guess at the arguments
+            va_end(args);
+            return;
+      }
+   }
+   va_end(args);
+}
+
+//Print an 8-bit or 16-bit unsigned integer
+void print_int(uint16_t i)
+{
+   print_fmt_P(PSTR("%u"), i);
+}
+
+//Print a 32-bit unsigned integer
+void print_int32(uint32_t i)
+{
+   print_fmt_P(PSTR("%lu"), i);
 }
 
 //Print an 8-bit or 16-bit unsigned integer in hex format
 void print_hex(uint16_t i)
 {
-   char str[10];
-   sprintf(str, "%#x", i);
-   print_string(str);
+   print_fmt_P(PSTR("0x%x"), i);
 }
 
 //Print a 32-bit unsigned integer in hex format
-void print_hex32(uint32_t i) {
-   char buf[32] = {0};
-   int ndx = 31;
+void print_hex32(uint32_t i)
+{
+   print_fmt_P(PSTR("0x%lx"), i);
+}
 
-   write_byte(0x1B);
-   write_byte('[');
-   write_byte('1');
-   write_byte('i');
-   write_byte('0');
-   write_byte('x');
+#ifdef SERIAL_BENCHMARK
+//Values the benchmark formats, small to as wide as 32 bits go
+static const uint32_t benchValues[] PROGMEM = {7, 1234, 65535, 4000000000UL};
 
-   for (; i && ndx; --ndx, i /= 16)
-      buf[ndx] = "0123456789abcdef"[i % 16];
+/*
+ * Prints the cycles sprintf and the formatter above take to turn the
+ * benchmark values into digits.  The digits go to a buffer so the wire
+ * speed does not count.
+ */
+void serial_benchmark()
+{
+   char buf[12];
+   uint32_t value, libcDec = 0, libcHex = 0, ownDec = 0, ownHex = 0;
+   uint16_t stamp;
+   uint8_t i, sreg;
 
-   while (ndx <= 31) write_byte(buf[ndx++]);
+   sreg = SREG;
+   cli();
+   for(i = 0; i < sizeof(benchValues) / sizeof(benchValues[0]); i++)
+   {
+      value = pgm_read_dword(&benchValues[i]);
+      stamp = cycle_stamp();
+      sprintf(buf, "%lu", value);
+      libcDec += cycles_since(stamp);
+      stamp = cycle_stamp();
+      format_decimal(value, buf);
+      ownDec += cycles_since(stamp);
+      stamp = cycle_stamp();
+      sprintf(buf, "%lx", value);
+      libcHex += cycles_since(stamp);
+      stamp = cycle_stamp();
+      format_hex(value, buf);
+      ownHex += cycles_since(stamp);
+   }
+   SREG = sreg;
 
-   return;
+   print_fmt_P(PSTR("\r\nCycles for %u values, sprintf / format_*\r\n"
+      "decimal: %lu / %lu\r\nhex: %lu / %lu\r\n"),
+      i, libcDec, ownDec, libcHex, ownHex);
 }
+#endif
 
 //Set the cursor position
 void set_cursor(uint8_t row, uint8_t col)
@@ -137,7 +473,7 @@ void set_color(uint8_t color)
 void clear_screen(void)
 {
    write_byte(ESC);
-   print_string("[2J");
+   print_string_P(PSTR("[2J"));
    set_cursor(0, 0);
    return;
 } 
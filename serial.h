@@ -0,0 +1,54 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+#include <stdint.h>
+
+//Bytes queued for the transmitter, a power of two up to 128
+//A stats redraw is about 84 bytes, a bigger ring only saves the console
+//thread some waiting while the line drains at 87us a byte
+#ifndef SERIAL_TX_SIZE
+#define SERIAL_TX_SIZE 16
+#endif
+//Bytes received and not yet read, a power of two up to 128
+#ifndef SERIAL_RX_SIZE
+#define SERIAL_RX_SIZE 8
+#endif
+
+#if SERIAL_TX_SIZE & (SERIAL_TX_SIZE - 1) || SERIAL_TX_SIZE > 128
+#error "SERIAL_TX_SIZE must be a power of two up to 128"
+#endif
+#if SERIAL_RX_SIZE & (SERIAL_RX_SIZE - 1) || SERIAL_RX_SIZE > 128
+#error "SERIAL_RX_SIZE must be a power of two up to 128"
+#endif
+
+struct serial_stats {
+   uint16_t rxDropped;     //Bytes that arrived with the receive ring full
+   uint16_t txWaits;       //Times a writer found the transmit ring full
+};
+
+void serial_init();
+uint8_t byte_available();
+uint8_t read_byte();
+uint8_t read_byte_wait();
+uint8_t write_byte(uint8_t b);
+uint8_t try_write_byte(uint8_t b);
+uint8_t serial_tx_free();
+struct serial_stats* get_serial_stats();
+
+uint8_t format_decimal(uint32_t value, char* out);
+uint8_t format_hex(uint32_t value, char* out);
+void print_fmt_P(const char* fmt, ...);
+#ifdef SERIAL_BENCHMARK
+void serial_benchmark();
+#endif
+
+void print_string(char* s);
+void print_string_P(const char* s);
+void print_int(uint16_t i);
+void print_int32(uint32_t i);
+void print_hex(uint16_t i);
+void print_hex32(uint32_t i);
+void set_cursor(uint8_t row, uint8_t col);
+void set_color(uint8_t color);
+void clear_screen(void);
+
+#endif
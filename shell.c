@@ -0,0 +1,256 @@
+#include <string.h>
+#include <avr/pgmspace.h>
+#include "shell.h"
+#include "serial.h"
+#include "screen.h"
+#include "os.h"
+#include "SdReader.h"
+#include "readahead.h"
+#include "jitter.h"
+#include "telemetry.h"
+
+#define ESC 27
+#define BACKSPACE 8
+#define DELETE 127
+
+//One command, the table lives in flash and is searched in order
+struct shell_command {
+   char name[9];
+   char help[32];
+   void (*run)(char* args);
+};
+
+static void cmd_help(char* args);
+static void cmd_ps(char* args);
+static void cmd_mem(char* args);
+static void cmd_sd(char* args);
+static void cmd_trace(char* args);
+static void cmd_counters(char* args);
+
+static const struct shell_command commands[] PROGMEM = {
+   {"help", "list the commands", cmd_help},
+   {"ps", "threads and their stacks", cmd_ps},
+   {"mem", "where the RAM went", cmd_mem},
+   {"sd", "card identity and size", cmd_sd},
+   {"trace", "dump the kernel trace", cmd_trace},
+   {"counters", "every statistic in one list", cmd_counters},
+};
+#define COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+//threadState_t as text
+static const char stateNames[][6] PROGMEM = {"run", "wait", "sleep", "ready"};
+
+static mutex_t* console;
+static mutex_t* card;
+static void (*passKey)(char);
+static char line[SHELL_LINE + 1];
+static uint8_t lineLen;
+static uint8_t editing;   //A command line is being typed
+
+static void show_line();
+static void run_line();
+static void start_output();
+static void end_output();
+
+//Shares the terminal through |consoleMut| and the card through |cardMut|,
+//keys typed outside a command line go to |key|
+void shell_init(mutex_t* consoleMut, mutex_t* cardMut, void (*key)(char))
+{
+   console = consoleMut;
+   card = cardMut;
+   passKey = key;
+}
+
+//Handles whatever was typed since the last call and returns without waiting.
+//The stats thread calls it between redraws, so the shell needs no stack of its own.
+void shell_poll()
+{
+   uint8_t c;
+
+   while(byte_available())
+   {
+      c = read_byte();
+      if(!editing)
+      {
+         if(c == SHELL_PROMPT_KEY)
+         {
+            editing = 1;
+            lineLen = 0;
+            show_line();
+         }
+         else
+            passKey(c);
+      }
+      else if(c == '\r' || c == '\n')
+      {
+         editing = 0;
+         run_line();
+      }
+      else if(c == ESC)
+      {
+         editing = 0;
+         start_output();
+         end_output();
+      }
+      else if(c == BACKSPACE || c == DELETE)
+      {
+         if(lineLen)
+            lineLen--;
+         show_line();
+      }
+      else if(c >= ' ' && lineLen < SHELL_LINE)
+      {
+         line[lineLen++] = c;
+         show_line();
+      }
+   }
+}
+
+//Takes the terminal and clears everything below the stats
+static void start_output()
+{
+   mutex_lock(console);
+   set_cursor(SHELL_ROW, 1);
+   //<ESC>[J clears to the end of the screen
+   write_byte(ESC);
+   write_byte('[');
+   write_byte('J');
+}
+
+//Gives the terminal back, the stats don't know where the cursor is now
+static void end_output()
+{
+   screen_cursor_lost();
+   mutex_unlock(console);
+}
+
+//Redraws the command line being typed
+static void show_line()
+{
+   uint8_t i;
+
+   start_output();
+   write_byte(SHELL_PROMPT_KEY);
+   for(i = 0; i < lineLen; i++)
+      write_byte(line[i]);
+   end_output();
+}
+
+//Runs the command typed, the first word names it and the rest is its |args|
+static void run_line()
+{
+   void (*run)(char*);
+   char* args;
+   uint8_t i;
+
+   line[lineLen] = '\0';
+   args = strchr(line, ' ');
+   if(args)
+   {
+      *args++ = '\0';
+      while(*args == ' ')
+         args++;
+   }
+   else
+      args = line + lineLen;
+
+   start_output();
+   print_fmt_P(PSTR("%c%s\r\n"), SHELL_PROMPT_KEY, line);
+   for(i = 0; i < COMMANDS; i++)
+   {
+      if(strcmp_P(line, commands[i].name) == 0)
+         break;
+   }
+   if(i < COMMANDS)
+   {
+      memcpy_P(&run, &commands[i].run, sizeof(run));
+      run(args);
+   }
+   else if(line[0])
+      print_fmt_P(PSTR("%s? try help\r\n"), line);
+   end_output();
+}
+
+static void cmd_help(char* args)
+{
+   uint8_t i;
+
+   for(i = 0; i < COMMANDS; i++)
+      print_fmt_P(PSTR("%9S%S\r\n"), commands[i].name, commands[i].help);
+}
+
+//The stack use comes from the paint at the bottom of each stack, so it is
+//the most a thread has ever used, not what it is using now
+static void cmd_ps(char* args)
+{
+   struct system_t* sysInfo = getSystemInfo();
+   struct thread_t* t;
+   uint8_t i;
+   uint16_t unused;
+
+   print_fmt_P(PSTR("id state  base stack  used  free sleep\r\n"));
+   for(i = 0; i < sysInfo->numThreads; i++)
+   {
+      t = &sysInfo->threads[i];
+      unused = thread_stack_free(i);
+      print_fmt_P(PSTR("%2u %6S %04x %5u %5u %5u %5u\r\n"), i,
+         stateNames[t->state], t->stackBase, t->stackSize, t->stackSize - unused,
+         unused, t->sleepCount);
+   }
+}
+
+static void cmd_mem(char* args)
+{
+   struct memory_map* map = get_memory_map();
+
+   print_fmt_P(PSTR("data %5u\r\nbss  %5u (stacks %u)\r\nheap %5u\r\n"),
+      map->data, map->bss, map->stacks, map->heap);
+   print_fmt_P(PSTR("gap  %5u (min %u)\r\n"), map->gap, map->minGap);
+}
+
+//The card is only asked under the filesystem's mutex, between the loader's reads
+static void cmd_sd(char* args)
+{
+   cid_t cid;
+   uint32_t blocks;
+   uint8_t ok;
+
+   mutex_lock(card);
+   ok = sdReadCID(&cid);
+   blocks = sdCardSize();
+   mutex_unlock(card);
+   if(!ok)
+   {
+      print_fmt_P(PSTR("no card\r\n"));
+      return;
+   }
+   //The CID is big endian
+   print_fmt_P(PSTR("mid %02x oid %c%c pnm %c%c%c%c%c rev %u.%u\r\n"), cid.mid,
+      cid.oid[0], cid.oid[1], cid.pnm[0], cid.pnm[1], cid.pnm[2], cid.pnm[3],
+      cid.pnm[4], cid.prv_n, cid.prv_m);
+   print_fmt_P(PSTR("serial %08lx made %u/%u size %luMB\r\n"),
+      __builtin_bswap32(cid.psn), cid.mdt_month,
+      2000 + (cid.mdt_year_high << 4 | cid.mdt_year_low), blocks >> 11);
+}
+
+//The stats thread sends it, it knows how to put the screen back
+static void cmd_trace(char* args)
+{
+   passKey('d');
+}
+
+static void cmd_counters(char* args)
+{
+   struct readahead_stats* ra = getReadaheadStats();
+   struct serial_stats* serial = get_serial_stats();
+
+   print_fmt_P(PSTR("ticks %lu\r\n"), getTicks());
+   print_fmt_P(PSTR("readahead fills %lu stalls %u slow %u maxlat %u\r\n"),
+      ra->fills, ra->stalls, ra->slowReads, ra->maxLatency);
+   print_fmt_P(PSTR("jitter max %luus\r\n"),
+      COUNTS_TO_US(get_jitter_stats()->maxInterval));
+   print_fmt_P(PSTR("serial dropped %u waits %u\r\n"),
+      serial->rxDropped, serial->txWaits);
+   print_fmt_P(PSTR("telemetry frames %lu screen bytes %lu\r\n"),
+      telem_frames(), screen_bytes());
+}
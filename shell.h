@@ -0,0 +1,19 @@
+#ifndef SHELL_H
+#define SHELL_H
+#include <stdint.h>
+#include "syncro.h"
+
+//Longest command line, the rest of a longer one is dropped
+//No command takes arguments yet and the longest name is 8 characters
+#ifndef SHELL_LINE
+#define SHELL_LINE 16
+#endif
+//Starts a command line, every other key is passed on as it is
+#define SHELL_PROMPT_KEY ':'
+//Terminal row of the command line, output goes below it
+#define SHELL_ROW 13
+
+void shell_init(mutex_t* console, mutex_t* card, void (*key)(char));
+void shell_poll();
+
+#endif
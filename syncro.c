@@ -6,7 +6,7 @@ void mutex_init(mutex_t* m)
     int i;
     cli();
     m->value = 1;
-    for(i; i < MAX_THREADS; i++)
+    for(i = 0; i < MAX_THREADS; i++)
         m->waitlist[i] = 0;
     sei();
 }
@@ -21,6 +21,7 @@ void mutex_lock(mutex_t* m)
     else
     {
         m->waitlist[getCurrentThread()] = 1;
+        TRACE(TRACE_MUTEX_BLOCK, getCurrentThread());
         blocked();
     }
     sei();
@@ -30,21 +31,20 @@ void mutex_unlock(mutex_t* m)
 {
     cli();
     int i;
-    if(!m->value)
+    //Hand the lock straight to a waiter so nobody takes it before the waiter runs
+    //This biases early threads
+    for(i = 0; i < MAX_THREADS; i++)
     {
-        m->value = 1;
-        //Make sure we have no one waiting on us
-        //This biases early threads
-        for(i; i < MAX_THREADS; i++)
+        if(m->waitlist[i])
         {
-            if(m->waitlist[i])
-            {
-                m->waitlist[i] = 0;
-                setThreadState(i, THREAD_READY);
-                break;
-            }
+            m->waitlist[i] = 0;
+            setThreadState(i, THREAD_READY);
+            TRACE(TRACE_MUTEX_WAKE, i);
+            sei();
+            return;
         }
     }
+    m->value = 1;
     sei();   
 }
 
@@ -54,7 +54,7 @@ void sem_init(semaphore_t* s, int8_t value)
     cli();
     int i;
     s->value = value;
-    for(i; i < MAX_THREADS; i++)
+    for(i = 0; i < MAX_THREADS; i++)
         s->waitlist[i] = 0;
     sei();
 }
@@ -63,12 +63,15 @@ void sem_init(semaphore_t* s, int8_t value)
 void sem_wait(semaphore_t* s)
 {
     cli();
+    int current = getCurrentThread();
     //Semaphore unavailable
     if(--s->value < 0)
     {
-        s->waitlist[getCurrentThread()] = 1;
-        setThreadState(getCurrentThread(), THREAD_WAITING);
-        threadSwap(get_next_thread(), getCurrentThread());
+        s->waitlist[current] = 1;
+        setThreadState(current, THREAD_WAITING);
+        TRACE(TRACE_SEM_BLOCK, current);
+        //get_next_thread() moves curThread, so swap out the saved index
+        threadSwap(get_next_thread(), current);
     }
     sei();
 }
@@ -78,44 +81,76 @@ void sem_signal(semaphore_t* s)
 {
     cli();
     int i;
+    uint8_t woken = TRACE_NONE;
     //Make sure we have no one waiting on us
     //This biases early threads
     if(++s->value <= 0)
     {
-        for(i; i < MAX_THREADS; i++)
+        for(i = 0; i < MAX_THREADS; i++)
         {
             if(s->waitlist[i])
             {
                 s->waitlist[i] = 0;
+                woken = i;
                 setThreadState(i, THREAD_READY);
                 break;
             }
         }
     }
+    TRACE(TRACE_SEM_SIGNAL, woken);
     sei();  
 }
 
 
+//Signal from an interrupt routine, interrupts are already disabled and
+//must stay that way until the routine returns
+void sem_signal_isr(semaphore_t* s)
+{
+    int i;
+    uint8_t woken = TRACE_NONE;
+    if(++s->value <= 0)
+    {
+        for(i = 0; i < MAX_THREADS; i++)
+        {
+            if(s->waitlist[i])
+            {
+                s->waitlist[i] = 0;
+                woken = i;
+                setThreadState(i, THREAD_READY);
+                break;
+            }
+        }
+    }
+    TRACE(TRACE_SEM_SIGNAL, woken);
+}
+
+
 void sem_signal_swap(semaphore_t* s)
 {
     cli();
     int i;
+    uint8_t woken = TRACE_NONE;
     //Make sure we have no one waiting on us
     //This biases early threads
     if(++s->value <= 0)
     {
-        for(i; i < MAX_THREADS; i++)
+        for(i = 0; i < MAX_THREADS; i++)
         {
             if(s->waitlist[i])
             {
                 s->waitlist[i] = 0;
+                woken = i;
                 setThreadState(i, THREAD_RUNNING);
                 setThreadState(getCurrentThread(), THREAD_READY);
+                //Before the swap, this thread won't be back for a while
+                TRACE(TRACE_SEM_SIGNAL, woken);
                 threadSwap(i, getCurrentThread());
                 break;
             }
         }
     }
+    if(woken == TRACE_NONE)
+        TRACE(TRACE_SEM_SIGNAL, woken);
     sei();  
 }
 
@@ -0,0 +1,93 @@
+#include "telemetry.h"
+#include "serial.h"
+#include "crc.h"
+#include "os.h"
+
+//Bytes around the payload: type and sequence before, CRC after
+#define FRAME_HEAD 2
+#define FRAME_EXTRA 4
+//Trace records per frame, kept small since they are copied to the stack
+#define TRACE_CHUNK 8
+
+static uint8_t seq;
+static uint32_t frames;
+
+//Byte |i| of the frame before encoding, so it never has to be copied whole
+static uint8_t frame_byte(uint8_t i, uint8_t type, const uint8_t* payload,
+   uint8_t len, uint16_t crc)
+{
+   if(i == 0)
+      return type;
+   if(i == 1)
+      return seq;
+   i -= FRAME_HEAD;
+   if(i < len)
+      return payload[i];
+   return i == len ? crc & 0xFF : crc >> 8;
+}
+
+//Sends |len| bytes at |payload| as one frame of |type|.  The COBS code byte
+//before each run of nonzero bytes counts the run, the zero after it is
+//implied, so the only zero on the wire ends the frame.
+void telem_send(uint8_t type, const void* payload, uint8_t len)
+{
+   const uint8_t* p = payload;
+   uint8_t head[FRAME_HEAD];
+   uint8_t n, start, end, i;
+   uint16_t crc;
+
+   if(len > TELEM_MAX_PAYLOAD)
+      return;
+   head[0] = type;
+   head[1] = seq;
+   crc = crcCcitt(0xFFFF, head, FRAME_HEAD);
+   crc = crcCcitt(crc, p, len);
+
+   n = len + FRAME_EXTRA;
+   start = 0;
+   while(1)
+   {
+      for(end = start; end < n && frame_byte(end, type, p, len, crc); end++)
+         ;
+      write_byte(end - start + 1);
+      for(i = start; i < end; i++)
+         write_byte(frame_byte(i, type, p, len, crc));
+      if(end == n)
+         break;
+      start = end + 1;
+   }
+   write_byte(0);
+   seq++;
+   frames++;
+}
+
+//Sends the kernel trace, oldest record first, and starts a new one
+//Without OS_TRACE only the end frame goes out, so a reader isn't left waiting
+void telem_trace()
+{
+   struct telem_trace_end end;
+#ifdef OS_TRACE
+   struct trace_record records[TRACE_CHUNK];
+   uint8_t n;
+
+   //Sending would trace itself and push out what is being sent
+   os_trace_freeze();
+#endif
+   //An empty frame, so whatever the screen sent last can't run into the first one
+   write_byte(0);
+#ifdef OS_TRACE
+   while((n = os_trace_take(records, TRACE_CHUNK)))
+      telem_send(TELEM_TRACE, records, n * sizeof(struct trace_record));
+   os_trace_restart();
+#endif
+   end.periodCounts = RUNTIME_COMPARE + 1;
+   end.countsPerUs = F_CPU / CYCLES_PER_COUNT / 1000000;
+   end.numThreads = getSystemInfo()->numThreads;
+   telem_send(TELEM_TRACE_END, &end, sizeof(end));
+}
+
+//Returns the frames sent since boot
+uint32_t telem_frames()
+{
+   return frames;
+}
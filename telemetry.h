@@ -0,0 +1,67 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <stdint.h>
+
+//Binary stats for a host to decode, see tools/telemdump.c
+//
+//Each frame is a type byte, a sequence number, the payload and the
+//CRC-CCITT of all three (low byte first), COBS encoded and ended by a zero.
+//Payloads are packed little endian structs, a host reads them as they are.
+
+#define TELEM_SYSTEM 1
+#define TELEM_THREAD 2
+#define TELEM_PLAYBACK 3
+#define TELEM_TRACE 4           //Payload: struct trace_record[], oldest first
+#define TELEM_TRACE_END 5
+
+//Longest payload, keeps every COBS run under 254 bytes
+#define TELEM_MAX_PAYLOAD 64
+
+struct telem_system {
+   uint32_t ticks;
+   uint16_t runtime;       //Seconds
+   uint16_t interrupts;
+   uint16_t tickHz;
+   uint8_t numThreads;
+   uint8_t curThread;
+} __attribute__((packed));
+
+//One per thread, the stack use is from the last context switch
+struct telem_thread {
+   uint8_t id;
+   uint8_t state;          //threadState_t
+   uint16_t stackSize;
+   uint16_t stackUsed;
+   uint16_t sleepCount;
+} __attribute__((packed));
+
+struct telem_playback {
+   uint16_t song;
+   uint16_t songs;
+   uint16_t sampleRate;
+   uint32_t positionMs;
+   uint32_t remaining;     //Bytes of the song's data
+   uint8_t raDepth;
+   uint8_t raTarget;
+   uint8_t raMinDepth;
+   uint16_t stalls;
+   uint32_t stallTicks;
+   uint16_t slowReads;
+   uint16_t maxLatency;
+   uint16_t jitterMaxUs;
+   uint8_t eqPreset;
+   uint16_t rxDropped;
+} __attribute__((packed));
+
+//Ends a trace dump, with what a reader needs to turn stamps into time
+struct telem_trace_end {
+   uint16_t periodCounts;  //Timer 1 counts before a stamp wraps
+   uint8_t countsPerUs;
+   uint8_t numThreads;     //A switch to this thread number is the idle loop
+} __attribute__((packed));
+
+void telem_send(uint8_t type, const void* payload, uint8_t len);
+void telem_trace();
+uint32_t telem_frames();
+
+#endif
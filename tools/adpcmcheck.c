@@ -0,0 +1,67 @@
+//Checks adpcm.c against the blocks and samples in tools/adpcmref.h, which
+//tools/adpcmref.py decodes with its own plain IMA decoder
+//The stream is decoded in one go, then split at every chunk size the loader
+//could hand over, headers included
+//
+//   make check
+#include <stdio.h>
+#include <string.h>
+#include "../adpcm.h"
+#include "adpcmref.h"
+
+//One block in, header sample plus two per code out
+#define SAMPLES_PER_BLOCK ((ADPCM_REF_BLOCK_ALIGN - ADPCM_HEADER_SIZE) * 2 + 1)
+typedef char refSizeCheck[sizeof(adpcmRefOut) == ADPCM_REF_BLOCKS * SAMPLES_PER_BLOCK
+   ? 1 : -1];
+
+uint8_t out[sizeof(adpcmRefOut)];
+
+//Decodes the reference stream |chunk| bytes at a time
+//Returns the number of samples that differ from the reference
+int decodeInChunks(uint16_t chunk)
+{
+   struct adpcm_state st;
+   uint16_t pos, n, samples = 0;
+   int bad = 0;
+
+   adpcmInit(&st, ADPCM_REF_BLOCK_ALIGN);
+   memset(out, 0, sizeof(out));
+   for(pos = 0; pos < sizeof(adpcmRefIn); pos += n)
+   {
+      n = sizeof(adpcmRefIn) - pos;
+      if(n > chunk)
+         n = chunk;
+      samples += adpcmDecode(&st, adpcmRefIn + pos, n, out + samples);
+   }
+   if(samples != sizeof(adpcmRefOut))
+   {
+      printf("  %u byte chunks: %u samples, expected %u\n", chunk, samples,
+         (unsigned)sizeof(adpcmRefOut));
+      return 1;
+   }
+   for(n = 0; n < samples; n++)
+   {
+      if(out[n] == adpcmRefOut[n])
+         continue;
+      //The first few are enough to see which block went wrong
+      if(bad++ < 4)
+         printf("  %u byte chunks: block %u sample %u is %u, expected %u\n", chunk,
+            n / SAMPLES_PER_BLOCK, n % SAMPLES_PER_BLOCK, out[n], adpcmRefOut[n]);
+   }
+   return bad;
+}
+
+int main()
+{
+   uint16_t chunk;
+   int failed = 0;
+
+   for(chunk = 1; chunk <= sizeof(adpcmRefIn); chunk++)
+   {
+      if(decodeInChunks(chunk))
+         failed++;
+   }
+   printf("adpcm: %u blocks, %u samples, %u chunk sizes, %d failed\n", ADPCM_REF_BLOCKS,
+      (unsigned)sizeof(adpcmRefOut), (unsigned)sizeof(adpcmRefIn), failed);
+   return failed != 0;
+}
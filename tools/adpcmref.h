@@ -0,0 +1,60 @@
+//Generated by tools/adpcmref.py, do not edit
+//Blocks, one after another:
+//  codes that wander like audio
+//  largest rises clamp at the top
+//  largest falls clamp at the bottom
+//  step index pinned at 0
+//  step index pinned at 88
+//  header index past the table
+//  silence
+#define ADPCM_REF_BLOCK_ALIGN 36
+#define ADPCM_REF_BLOCKS 7
+static const uint8_t adpcmRefIn[252] = {
+   232, 3, 20, 0, 220, 4, 101, 170, 31, 173, 29, 90, 218, 229, 172, 27,
+   30, 95, 19, 112, 121, 108, 253, 16, 255, 25, 175, 96, 29, 4, 172, 180,
+   29, 2, 43, 70, 0, 125, 60, 0, 119, 119, 119, 119, 119, 119, 119, 119,
+   119, 119, 119, 119, 119, 119, 119, 119, 119, 119, 119, 119, 119, 119, 119, 119,
+   119, 119, 119, 119, 119, 119, 119, 119, 0, 131, 60, 0, 255, 255, 255, 255,
+   255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+   255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   251, 255, 80, 0, 127, 247, 127, 247, 127, 247, 127, 247, 127, 247, 127, 247,
+   127, 247, 127, 247, 127, 247, 127, 247, 127, 247, 127, 247, 127, 247, 127, 247,
+   127, 247, 127, 247, 57, 48, 200, 0, 120, 115, 58, 242, 223, 95, 174, 183,
+   8, 89, 209, 238, 57, 16, 203, 72, 149, 181, 204, 137, 41, 17, 255, 6,
+   182, 98, 46, 223, 60, 249, 53, 253, 0, 0, 0, 0, 136, 8, 128, 0,
+   136, 8, 128, 0, 136, 8, 128, 0, 136, 8, 128, 0, 136, 8, 128, 0,
+   136, 8, 128, 0, 136, 8, 128, 0, 136, 8, 128, 0,
+};
+static const uint8_t adpcmRefOut[455] = {
+   131, 131, 131, 131, 131, 132, 133, 132, 132, 130, 131, 128, 127, 124, 125, 124,
+   127, 125, 120, 127, 115, 100, 91, 78, 83, 64, 72, 36, 92, 144, 165, 171,
+   255, 219, 255, 112, 255, 80, 0, 15, 59, 0, 0, 0, 43, 0, 0, 14,
+   186, 10, 58, 189, 205, 74, 0, 130, 18, 0, 47, 120, 133, 49, 104, 233,
+   255, 253, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+   255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+   255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+   255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+   255, 255, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+   0, 0, 0, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 127, 16, 255, 255, 16, 0, 239, 255, 16, 0, 239, 255,
+   16, 0, 239, 255, 16, 0, 239, 255, 16, 0, 239, 255, 16, 0, 239, 255,
+   16, 0, 239, 255, 16, 0, 239, 255, 16, 0, 239, 255, 16, 0, 239, 255,
+   16, 0, 239, 255, 16, 0, 239, 255, 16, 0, 239, 255, 16, 0, 239, 255,
+   16, 0, 239, 255, 16, 176, 160, 255, 255, 255, 176, 255, 255, 75, 0, 0,
+   0, 175, 0, 0, 218, 106, 91, 104, 68, 189, 237, 77, 0, 0, 0, 101,
+   115, 151, 74, 0, 0, 98, 243, 195, 255, 144, 13, 0, 0, 0, 0, 60,
+   92, 122, 0, 0, 207, 223, 255, 144, 216, 255, 48, 128, 0, 0, 0, 111,
+   68, 0, 175, 255, 95, 0, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+   128, 128, 128, 128, 128, 128, 128,
+};
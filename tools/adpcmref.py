@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# Writes tools/adpcmref.h, IMA ADPCM blocks and what they decode to, for
+# tools/adpcmcheck.c.  The decoder here is the plain signed one from the IMA
+# recommendation, written separately from adpcm.c so the two can be checked
+# against each other:
+#
+#   python3 tools/adpcmref.py > tools/adpcmref.h
+#
+# Samples are given as 8-bit unsigned, the high byte of the 16-bit sample
+# plus 128, the way 8-bit WAV data is stored.
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767,
+]
+INDEX_ADJUST = [-1, -1, -1, -1, 2, 4, 6, 8]
+BLOCK_ALIGN = 36        # 4 byte header and 64 codes, 65 samples
+
+
+def clamp(v, lo, hi):
+    return lo if v < lo else hi if v > hi else v
+
+
+def decode_block(block):
+    sample = int.from_bytes(block[0:2], 'little', signed=True)
+    # An index past the table is clamped, as adpcm.c does
+    index = clamp(block[2], 0, len(STEPS) - 1)
+    out = [sample]
+    for b in block[4:]:
+        for code in (b & 0x0F, b >> 4):
+            step = STEPS[index]
+            diff = step >> 3
+            if code & 4:
+                diff += step
+            if code & 2:
+                diff += step >> 1
+            if code & 1:
+                diff += step >> 2
+            sample = clamp(sample - diff if code & 8 else sample + diff, -32768, 32767)
+            index = clamp(index + INDEX_ADJUST[code & 7], 0, len(STEPS) - 1)
+            out.append(sample)
+    return out
+
+
+def header(sample, index):
+    return list((sample & 0xFFFF).to_bytes(2, 'little')) + [index, 0]
+
+
+def blocks():
+    # Fixed seed so the file only changes with this script
+    seed = 12345
+
+    def rand():
+        nonlocal seed
+        seed = (seed * 1103515245 + 12345) & 0x7FFFFFFF
+        return seed >> 16
+
+    data = BLOCK_ALIGN - 4
+    yield 'codes that wander like audio', header(1000, 20) + [rand() & 0xFF for _ in range(data)]
+    yield 'largest rises clamp at the top', header(32000, 60) + [0x77] * data
+    yield 'largest falls clamp at the bottom', header(-32000, 60) + [0xFF] * data
+    yield 'step index pinned at 0', header(0, 0) + [0x00] * data
+    yield 'step index pinned at 88', header(-5, 80) + [0x7F, 0xF7] * (data // 2)
+    yield 'header index past the table', header(12345, 200) + [rand() & 0xFF for _ in range(data)]
+    yield 'silence', header(0, 0) + [0x88, 0x08, 0x80, 0x00] * (data // 4)
+
+
+def main():
+    cases = list(blocks())
+    stream, expect = [], []
+    for _, block in cases:
+        assert len(block) == BLOCK_ALIGN
+        stream += block
+        expect += [(s >> 8) + 128 for s in decode_block(block)]
+
+    print('//Generated by tools/adpcmref.py, do not edit')
+    print('//Blocks, one after another:')
+    for name, _ in cases:
+        print('//  %s' % name)
+    print('#define ADPCM_REF_BLOCK_ALIGN %d' % BLOCK_ALIGN)
+    print('#define ADPCM_REF_BLOCKS %d' % len(cases))
+    for label, values in (('adpcmRefIn', stream), ('adpcmRefOut', expect)):
+        print('static const uint8_t %s[%d] = {' % (label, len(values)))
+        for i in range(0, len(values), 16):
+            print('   ' + ', '.join('%d' % v for v in values[i:i + 16]) + ',')
+        print('};')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,60 @@
+# Counts the cycles of one function in avr-objdump -d output for the ATmega328P
+# Every instruction is counted once with branches and skips taken, so for code
+# without loops the total is an upper bound on one call
+#
+#   avr-objdump -d main.elf | awk -v fn=mix_sample -v budget=120 -f tools/cycles.awk
+#
+# Exits 1 when the total is over budget
+
+BEGIN {
+   split("mul muls mulsu fmul fmuls fmulsu adiw sbiw ld ldd st std lds sts push pop " \
+      "rjmp ijmp sbi cbi brbs brbc breq brne brcs brcc brsh brlo brmi brpl brge brlt " \
+      "brhs brhc brts brtc brvs brvc brie brid", two)
+   for(i in two)
+      cost[two[i]] = 2
+   split("rcall icall jmp lpm elpm cpse sbrc sbrs sbic sbis", three)
+   for(i in three)
+      cost[three[i]] = 3
+   split("call ret reti", four)
+   for(i in four)
+      cost[four[i]] = 4
+   inside = 0
+   total = 0
+   calls = 0
+}
+
+# Function headers look like "00000123 <mix_sample>:"
+/^[0-9a-f]+ <.*>:$/ {
+   inside = ($2 == "<" fn ">:")
+   if(inside)
+      found = 1
+   next
+}
+
+inside && /^ +[0-9a-f]+:\t/ {
+   n = split($0, field, "\t")
+   if(n < 3)
+      next
+   split(field[3], op, " ")
+   mnemonic = op[1]
+   total += (mnemonic in cost) ? cost[mnemonic] : 1
+   if(mnemonic == "call" || mnemonic == "rcall" || mnemonic == "icall")
+      calls++
+}
+
+END {
+   if(!found)
+   {
+      print fn ": not found" > "/dev/stderr"
+      exit 1
+   }
+   printf "%s: %d cycles, budget %d", fn, total, budget
+   if(calls)
+      printf ", %d calls not counted inside", calls
+   printf "\n"
+   if(budget && total > budget)
+   {
+      print fn ": over the cycle budget" > "/dev/stderr"
+      exit 1
+   }
+}
@@ -0,0 +1,209 @@
+//Checks ext.c against a small ext2 image built here in memory, with its super
+//block corrupted and with metadata blocks that fail to read, the way a worn
+//or half written card does
+//The image has 1024 byte blocks and one file, big enough to need the indirect
+//and double indirect blocks
+//
+//   make check
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "../blockdev.h"
+#include "../ext.h"
+
+#define BLOCK 1024
+#define BLOCKS 64
+#define INODE_TABLE 5
+#define ROOT_DIR 20
+#define FIRST_DATA 30           //Direct blocks 30 to 41, each filled with its number
+#define IND 50                  //Every entry points at block 42
+#define DIND 51                 //Entry 0 points at DIND_IND
+#define DIND_IND 52             //Entries alternate between blocks 43 and 44
+#define SONG_INODE 12
+#define SONG_BLOCKS (12 + BLOCK / 4 + 2)
+
+uint8_t image[BLOCKS * BLOCK];
+struct ram_disk ram;
+struct block_device disk;
+uint32_t failBlock;             //Reads of this block fail, 0 for none
+
+//Reads the ram disk, except for failBlock
+uint8_t faultyRead(struct block_device* dev, uint32_t sector, uint16_t offset,
+   uint8_t* dst, uint16_t count)
+{
+   if(failBlock && sector * BLOCKDEV_SECTOR_SIZE / BLOCK == failBlock)
+      return 0;
+   return bdRead(&ram.dev, sector, offset, dst, count);
+}
+
+struct ext2_inode* inode(uint32_t num)
+{
+   return (struct ext2_inode*)(image + INODE_TABLE * BLOCK + (num - 1) * 128);
+}
+
+uint32_t* pointers(uint32_t block)
+{
+   return (uint32_t*)(image + block * BLOCK);
+}
+
+//Adds a directory entry at |pos| in the root directory, returns the next position
+uint16_t dirEntry(uint16_t pos, uint32_t inodeNum, const char* name, uint16_t recLen)
+{
+   struct ext2_dir_entry* entry = (struct ext2_dir_entry*)(image + ROOT_DIR * BLOCK + pos);
+
+   entry->inode = inodeNum;
+   entry->rec_len = recLen;
+   entry->name_len = strlen(name);
+   memcpy(entry->name, name, strlen(name));
+   return pos + recLen;
+}
+
+void makeImage()
+{
+   struct ext2_super_block* super = (struct ext2_super_block*)(image + BLOCK);
+   struct ext2_group_desc* group = (struct ext2_group_desc*)(image + 2 * BLOCK);
+   uint16_t pos = 0;
+   uint32_t i;
+
+   memset(image, 0, sizeof(image));
+   super->s_inodes_count = 32;
+   super->s_blocks_count = BLOCKS;
+   super->s_first_data_block = 1;
+   super->s_log_block_size = 0;
+   super->s_inodes_per_group = 32;
+   super->s_magic = EXT2_SUPER_MAGIC;
+   super->s_rev_level = EXT2_GOOD_OLD_REV;
+   group->bg_inode_table = INODE_TABLE;
+
+   inode(EXT2_ROOT_INO)->i_mode = 0x41ED;
+   inode(EXT2_ROOT_INO)->i_size = BLOCK;
+   inode(EXT2_ROOT_INO)->i_block[0] = ROOT_DIR;
+   pos = dirEntry(pos, EXT2_ROOT_INO, ".", 12);
+   pos = dirEntry(pos, EXT2_ROOT_INO, "..", 12);
+   pos = dirEntry(pos, 11, "lost+found", 20);
+   dirEntry(pos, SONG_INODE, "big.wav", BLOCK - pos);
+
+   inode(SONG_INODE)->i_mode = 0x81A4;
+   inode(SONG_INODE)->i_size = SONG_BLOCKS * BLOCK;
+   for(i = 0; i < 12; i++)
+      inode(SONG_INODE)->i_block[i] = FIRST_DATA + i;
+   inode(SONG_INODE)->i_block[EXT2_IND_BLOCK] = IND;
+   inode(SONG_INODE)->i_block[EXT2_DIND_BLOCK] = DIND;
+   for(i = 0; i < BLOCK / 4; i++)
+   {
+      pointers(IND)[i] = FIRST_DATA + 12;
+      pointers(DIND_IND)[i] = FIRST_DATA + 13 + (i & 1);
+   }
+   pointers(DIND)[0] = DIND_IND;
+   for(i = FIRST_DATA; i <= FIRST_DATA + 14; i++)
+      memset(image + i * BLOCK, i, BLOCK);
+}
+
+int failed, checks;
+
+void expect(const char* name, uint32_t got, uint32_t want)
+{
+   checks++;
+   if(got == want)
+      return;
+   printf("  %s: %lu, expected %lu\n", name, (unsigned long)got, (unsigned long)want);
+   failed++;
+}
+
+//Mounts the image with |block| failing to read, after makeImage() and any damage
+uint8_t mount(uint32_t block)
+{
+   failBlock = block;
+   return extMount(&disk);
+}
+
+//Reads |count| bytes at file block |fileBlock| plus |offset|
+//Returns the number read, 0xFFFF if they don't all hold |value|
+uint16_t readAt(struct ext_file* file, uint32_t fileBlock, uint16_t offset, uint16_t count,
+   uint8_t value)
+{
+   uint8_t data[16];
+   uint16_t got = extReadFile(file, fileBlock * BLOCK + offset, data, count);
+   uint16_t i;
+
+   for(i = 0; i < got; i++)
+   {
+      if(data[i] != value)
+         return 0xFFFF;
+   }
+   return got;
+}
+
+int main()
+{
+   struct ext2_super_block* super = (struct ext2_super_block*)(image + BLOCK);
+   struct ext_file file;
+   char name[MAX_NAME_LEN];
+   uint8_t data[8];
+
+   ramDiskInit(&ram, image, sizeof(image) / BLOCKDEV_SECTOR_SIZE);
+   memset(&disk, 0, sizeof(disk));
+   disk.read = faultyRead;
+
+   //The good image
+   makeImage();
+   expect("mounts", mount(0), 1);
+   expect("songs", extCountSongs(), 1);
+   expect("opens", extOpen(0, &file, name), 1);
+   expect("name", strcmp(name, "big.wav"), 0);
+   expect("direct block", readAt(&file, 3, 0, 4, FIRST_DATA + 3), 4);
+   expect("across into the indirect block", extReadFile(&file, 12 * BLOCK - 4, data, 8) == 8
+      && data[3] == FIRST_DATA + 11 && data[4] == FIRST_DATA + 12, 1);
+   expect("double indirect", readAt(&file, SONG_BLOCKS - 2, 0, 4, FIRST_DATA + 13), 4);
+   expect("double indirect next", readAt(&file, SONG_BLOCKS - 1, 0, 4, FIRST_DATA + 14), 4);
+
+   //Super blocks that must not mount
+   super->s_magic = 0;
+   expect("bad magic", mount(0), 0);
+   makeImage();
+   super->s_log_block_size = 3;
+   expect("blocks past 4096 bytes", mount(0), 0);
+   makeImage();
+   super->s_inodes_per_group = 0;
+   expect("no inodes per group", mount(0), 0);
+   makeImage();
+   super->s_rev_level = 1;
+   super->s_inode_size = 0;
+   expect("no inode size", mount(0), 0);
+   makeImage();
+   expect("super block unreadable", mount(1), 0);
+   expect("group descriptors unreadable", mount(2), 0);
+   expect("inode table unreadable", mount(INODE_TABLE), 0);
+
+   //An unreadable root directory mounts with no songs
+   expect("root unreadable mounts", mount(ROOT_DIR), 1);
+   expect("root unreadable songs", extCountSongs(), 0);
+   expect("root unreadable opens", extOpen(0, &file, NULL), 0);
+
+   //Unreadable pointer blocks stop the read, and aren't remembered once the
+   //card reads again
+   expect("remount", mount(0), 1);
+   expect("reopen", extOpen(0, &file, NULL), 1);
+   failBlock = IND;
+   expect("indirect unreadable", readAt(&file, 12, 0, 4, 0), 0);
+   expect("indirect unreadable sector", extFileSector(&file, 12 * BLOCK + 512), 0);
+   expect("read up to the indirect", readAt(&file, 11, BLOCK - 4, 8, FIRST_DATA + 11), 4);
+   failBlock = 0;
+   expect("indirect readable again", readAt(&file, 12, 0, 4, FIRST_DATA + 12), 4);
+   failBlock = DIND;
+   expect("double indirect unreadable", readAt(&file, SONG_BLOCKS - 2, 0, 4, 0), 0);
+   failBlock = DIND_IND;
+   expect("its indirect unreadable", readAt(&file, SONG_BLOCKS - 1, 0, 4, 0), 0);
+   failBlock = 0;
+
+   //Holes in the block map read nothing rather than the boot block
+   inode(SONG_INODE)->i_block[EXT2_IND_BLOCK] = 0;
+   pointers(DIND)[0] = 0;
+   expect("reopen with holes", extOpen(0, &file, NULL), 1);
+   expect("no indirect block", readAt(&file, 12, 0, 4, 0), 0);
+   expect("no double indirect entry", readAt(&file, SONG_BLOCKS - 1, 0, 4, 0), 0);
+   expect("no indirect sector", extFileSector(&file, 12 * BLOCK + 512), 0);
+
+   printf("ext: %d checks, %d failed\n", checks, failed);
+   return failed != 0;
+}
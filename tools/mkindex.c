@@ -0,0 +1,142 @@
+//Writes the playlist index into an ext2 image or an unmounted card
+//The index file has to exist in the root directory already, big enough for
+//an entry per song plus the header, it is filled in place so the directory
+//and its mtime stay as they are
+//The firmware finds it by name wherever it is, but each entry before it costs
+//a read at boot, so it is best made on the fresh filesystem before the songs:
+//
+//   mke2fs -t ext2 /dev/sdX1 && mount /dev/sdX1 /media/card
+//   head -c 8192 /dev/zero > /media/card/.songidx
+//   cp *.wav /media/card
+//   umount /media/card
+//   tools/mkindex /dev/sdX1
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "../blockdev.h"
+#include "../ext.h"
+#include "../crc.h"
+#include "../wav.h"
+
+//The firmware reads entries as 128 byte records on both sides
+typedef char entrySizeCheck[sizeof(struct ext_index_entry) == 128 ? 1 : -1];
+typedef char headerSizeCheck[sizeof(struct ext_index_header) <= 128 ? 1 : -1];
+
+FILE* out;
+struct ext_file indexFile;
+
+//Writes |count| bytes of |src| at |pos| in the index file, within one sector
+int writeIndex(uint32_t pos, const void* src, uint16_t count)
+{
+   long at = (long)extFileSector(&indexFile, pos) * BLOCKDEV_SECTOR_SIZE
+      + pos % BLOCKDEV_SECTOR_SIZE;
+   return !fseek(out, at, SEEK_SET) && fwrite(src, 1, count, out) == count;
+}
+
+int main(int argc, char** argv)
+{
+   struct block_device disk;
+   struct ext_index_header header;
+   struct ext_index_entry entry;
+   struct ext_file file;
+   struct wav_info wav;
+   uint8_t pad[sizeof(struct ext_index_entry)];
+   uint32_t indexInode, pos;
+   uint16_t songs, i, runs = 0;
+
+   if(argc != 2)
+   {
+      fprintf(stderr, "usage: %s image\n", argv[0]);
+      return 2;
+   }
+   if(!hostDiskOpen(&disk, argv[1]) || !extMount(&disk))
+   {
+      fprintf(stderr, "%s: not an ext2 image\n", argv[1]);
+      return 1;
+   }
+   if(!extFindRoot(EXT_INDEX_NAME, &indexInode) || !extOpenInode(indexInode, &indexFile))
+   {
+      fprintf(stderr, "%s: no %s in the root directory, create it first\n",
+         argv[1], EXT_INDEX_NAME);
+      return 1;
+   }
+   songs = extCountSongs();
+   if(indexFile.size < (uint32_t)(songs + 1) * sizeof(struct ext_index_entry))
+   {
+      fprintf(stderr, "%s: %s needs at least %u bytes for %u songs\n", argv[1],
+         EXT_INDEX_NAME, (unsigned)((songs + 1) * sizeof(struct ext_index_entry)), songs);
+      return 1;
+   }
+   //A hole or an unreadable block map gives sector 0, writing there would
+   //trash the boot block
+   for(pos = 0; pos < (uint32_t)(songs + 1) * sizeof(struct ext_index_entry);
+      pos += sizeof(struct ext_index_entry))
+   {
+      if(!extFileSector(&indexFile, pos))
+      {
+         fprintf(stderr, "%s: %s is sparse, fill it with data instead of "
+            "truncating it to size\n", argv[1], EXT_INDEX_NAME);
+         return 1;
+      }
+   }
+   out = fopen(argv[1], "r+b");
+   if(!out)
+   {
+      perror(argv[1]);
+      return 1;
+   }
+
+   memset(pad, 0, sizeof(pad));
+   memset(&header, 0, sizeof(header));
+   header.magic = EXT_INDEX_MAGIC;
+   header.dirMtime = getInode(EXT2_ROOT_INO).i_mtime;
+   header.version = EXT_INDEX_VERSION;
+   header.count = songs;
+   header.entrySize = sizeof(struct ext_index_entry);
+   header.crc = crcCcitt(0xFFFF, &header, offsetof(struct ext_index_header, crc));
+   memcpy(pad, &header, sizeof(header));
+   if(!writeIndex(0, pad, sizeof(pad)))
+   {
+      perror(argv[1]);
+      return 1;
+   }
+
+   for(i = 0; i < songs; i++)
+   {
+      //The rest keep stale entries, their crc makes the player walk the directory
+      if(!extIndexEntry(i, &entry))
+      {
+         fprintf(stderr, "%s: can't read the block map of song %u\n", argv[1], i);
+         return 1;
+      }
+      //Songs the player can't convert are listed with no format so they are skipped
+      if(extOpen(i, &file, NULL) && wavOpen(&file, &wav))
+      {
+         entry.audio.dataStart = wav.dataStart;
+         entry.audio.dataSize = wav.dataSize;
+         entry.audio.format = wav.format;
+         entry.audio.sampleRate = wav.sampleRate;
+         entry.audio.blockAlign = wav.blockAlign;
+         entry.audio.channels = wav.channels;
+         entry.audio.bits = wav.bits;
+      }
+      entry.crc = crcCcitt(0xFFFF, &entry, offsetof(struct ext_index_entry, crc));
+      if(!writeIndex((uint32_t)(i + 1) * sizeof(struct ext_index_entry), &entry, sizeof(entry)))
+      {
+         perror(argv[1]);
+         return 1;
+      }
+      runs += entry.extents;
+      printf("%3u %-40s %8u bytes %5u Hz %s\n", i, entry.name, entry.size,
+         entry.audio.sampleRate, entry.extents ? "runs" : "block map");
+   }
+
+   if(fclose(out))
+   {
+      perror(argv[1]);
+      return 1;
+   }
+   hostDiskClose(&disk);
+   printf("%u songs indexed, %u block runs\n", songs, runs);
+   return 0;
+}
@@ -0,0 +1,419 @@
+//Decodes the binary telemetry the player sends after t is pressed, see
+//telemetry.h, into one JSON object per line, or CSV with -c:
+//
+//   tools/telemdump /dev/ttyACM0
+//   tools/telemdump -c capture.bin > stats.csv
+//
+//With -t it waits for the kernel trace the player sends when d is pressed,
+//built with make DEFS=-DOS_TRACE, and writes it in Chrome's trace event
+//format for chrome://tracing or ui.perfetto.dev:
+//
+//   tools/telemdump -t /dev/ttyACM0 > trace.json
+//
+//A tty is switched to 115200 baud raw, anything else is read as it is and
+//stdin is read when no file is given.  Frames that fail the CRC are
+//counted on stderr and skipped.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include "../telemetry.h"
+#include "../crc.h"
+#include "../os.h"
+
+#define FIELD(type, name) {#name, offsetof(type, name), sizeof(((type*)0)->name)}
+
+struct field {
+   const char* name;
+   size_t offset;
+   size_t size;
+};
+
+struct packet {
+   uint8_t type;
+   const char* name;
+   size_t size;
+   const struct field* fields;
+   int fieldCount;
+   int headerDone;         //CSV header already written
+};
+
+const struct field systemFields[] = {
+   FIELD(struct telem_system, ticks),
+   FIELD(struct telem_system, runtime),
+   FIELD(struct telem_system, interrupts),
+   FIELD(struct telem_system, tickHz),
+   FIELD(struct telem_system, numThreads),
+   FIELD(struct telem_system, curThread),
+};
+
+const struct field threadFields[] = {
+   FIELD(struct telem_thread, id),
+   FIELD(struct telem_thread, state),
+   FIELD(struct telem_thread, stackSize),
+   FIELD(struct telem_thread, stackUsed),
+   FIELD(struct telem_thread, sleepCount),
+};
+
+const struct field playbackFields[] = {
+   FIELD(struct telem_playback, song),
+   FIELD(struct telem_playback, songs),
+   FIELD(struct telem_playback, sampleRate),
+   FIELD(struct telem_playback, positionMs),
+   FIELD(struct telem_playback, remaining),
+   FIELD(struct telem_playback, raDepth),
+   FIELD(struct telem_playback, raTarget),
+   FIELD(struct telem_playback, raMinDepth),
+   FIELD(struct telem_playback, stalls),
+   FIELD(struct telem_playback, stallTicks),
+   FIELD(struct telem_playback, slowReads),
+   FIELD(struct telem_playback, maxLatency),
+   FIELD(struct telem_playback, jitterMaxUs),
+   FIELD(struct telem_playback, eqPreset),
+   FIELD(struct telem_playback, rxDropped),
+};
+
+#define COUNT(a) (int)(sizeof(a) / sizeof(a[0]))
+
+struct packet packets[] = {
+   {TELEM_SYSTEM, "system", sizeof(struct telem_system), systemFields, COUNT(systemFields), 0},
+   {TELEM_THREAD, "thread", sizeof(struct telem_thread), threadFields, COUNT(threadFields), 0},
+   {TELEM_PLAYBACK, "playback", sizeof(struct telem_playback), playbackFields,
+      COUNT(playbackFields), 0},
+};
+
+//Timeline rows in the trace besides the threads
+#define TID_ISR 16
+#define TID_SD 32
+
+int csv = 0;
+int traceMode = 0;
+unsigned long badFrames = 0;
+struct trace_record* trace = NULL;
+size_t traceLen = 0;
+int traceFirst = 1;
+
+const char* isrNames[] = {"tick", "runtime clock", "uart rx", "uart tx"};
+
+//Reads a little endian value of |size| bytes, the firmware's byte order
+unsigned long readValue(const uint8_t* p, size_t size)
+{
+   unsigned long value = 0;
+   while(size--)
+      value = value << 8 | p[size];
+   return value;
+}
+
+//Undoes COBS in place, returns the decoded length or -1 if it is malformed
+int cobsDecode(uint8_t* buf, int len)
+{
+   int in = 0, out = 0, code, i;
+
+   while(in < len)
+   {
+      code = buf[in++];
+      if(!code || in + code - 1 > len)
+         return -1;
+      for(i = 1; i < code; i++)
+         buf[out++] = buf[in++];
+      //The zero a run stands for, except after the last one
+      if(in < len)
+         buf[out++] = 0;
+   }
+   return out;
+}
+
+//Starts one trace event, the caller finishes the object
+void traceEvent(const char* ph, int tid, double ts, const char* name)
+{
+   printf("%s\n{\"ph\":\"%s\",\"pid\":0,\"tid\":%d,\"ts\":%.1f", traceFirst ? "" : ",",
+      ph, tid, ts);
+   if(name)
+      printf(",\"name\":\"%s\"", name);
+   traceFirst = 0;
+}
+
+//Names a row of the timeline
+void traceRow(int tid, const char* name)
+{
+   traceEvent("M", tid, 0, "thread_name");
+   printf(",\"args\":{\"name\":\"%s\"}}", name);
+}
+
+//Writes the collected trace records as a Chrome trace event document
+void writeTrace(const struct telem_trace_end* end)
+{
+   unsigned long base = 0;
+   uint16_t prev = 0;
+   int running = -1, sdOpen = 0, sdCommand = 0, isrOpen[4] = {0};
+   char name[32];
+   double ts = 0;
+   size_t i;
+   int t;
+
+   printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+   for(t = 0; t < end->numThreads; t++)
+   {
+      sprintf(name, "thread %d", t);
+      traceRow(t, name);
+   }
+   traceRow(end->numThreads, "idle");
+   for(t = 0; t < 4; t++)
+   {
+      sprintf(name, "isr %s", isrNames[t]);
+      traceRow(TID_ISR + t, name);
+   }
+   traceRow(TID_SD, "sd card");
+
+   for(i = 0; i < traceLen; i++)
+   {
+      const struct trace_record* r = &trace[i];
+
+      //Stamps wrap every period, records are never a whole period apart
+      if(r->time < prev)
+         base += end->periodCounts;
+      prev = r->time;
+      ts = (double)(base + r->time) / end->countsPerUs;
+
+      switch(r->event)
+      {
+         case TRACE_SWITCH:
+            if(running >= 0)
+            {
+               traceEvent("E", running, ts, NULL);
+               printf("}");
+            }
+            running = r->arg & 0xF;
+            traceEvent("B", running, ts, "run");
+            printf("}");
+            break;
+         case TRACE_ISR_ENTER:
+         case TRACE_ISR_EXIT:
+            if(r->arg >= 4)
+               break;
+            //An exit whose entry came before the dump has nothing to end
+            if(r->event == TRACE_ISR_EXIT && !isrOpen[r->arg])
+               break;
+            isrOpen[r->arg] = r->event == TRACE_ISR_ENTER;
+            traceEvent(r->event == TRACE_ISR_ENTER ? "B" : "E", TID_ISR + r->arg, ts,
+               isrNames[r->arg]);
+            printf("}");
+            break;
+         case TRACE_MUTEX_BLOCK:
+         case TRACE_MUTEX_WAKE:
+         case TRACE_SEM_BLOCK:
+            traceEvent("i", r->arg, ts, r->event == TRACE_MUTEX_BLOCK ? "mutex block"
+               : r->event == TRACE_MUTEX_WAKE ? "mutex wake" : "semaphore block");
+            printf(",\"s\":\"t\"}");
+            break;
+         case TRACE_SEM_SIGNAL:
+            if(r->arg == TRACE_NONE)
+               traceEvent("i", running < 0 ? 0 : running, ts, "semaphore signal, no waiter");
+            else
+               traceEvent("i", r->arg, ts, "semaphore wake");
+            printf(",\"s\":\"t\"}");
+            break;
+         case TRACE_SD_COMMAND:
+            if(sdOpen)
+            {
+               traceEvent("E", TID_SD, ts, NULL);
+               printf("}");
+            }
+            sprintf(name, "CMD%d", r->arg);
+            traceEvent("B", TID_SD, ts, name);
+            printf("}");
+            sdOpen = 1;
+            sdCommand = r->arg;
+            break;
+         case TRACE_SD_RESPONSE:
+            sprintf(name, "R1 0x%02x", r->arg);
+            traceEvent("i", TID_SD, ts, name);
+            printf(",\"s\":\"t\"}");
+            //Single block reads go on until the data is in
+            if(sdOpen && sdCommand != 17)
+            {
+               traceEvent("E", TID_SD, ts, NULL);
+               printf("}");
+               sdOpen = 0;
+            }
+            break;
+         case TRACE_SD_DATA:
+            if(sdOpen)
+            {
+               traceEvent("E", TID_SD, ts, NULL);
+               printf("}");
+               sdOpen = 0;
+            }
+            break;
+         case TRACE_UNDERRUN:
+            traceEvent("i", TID_SD, ts, "underrun");
+            printf(",\"s\":\"g\"}");
+            break;
+      }
+   }
+
+   //Close whatever was still going when the dump was taken
+   if(running >= 0)
+   {
+      traceEvent("E", running, ts, NULL);
+      printf("}");
+   }
+   if(sdOpen)
+   {
+      traceEvent("E", TID_SD, ts, NULL);
+      printf("}");
+   }
+   for(t = 0; t < 4; t++)
+   {
+      if(isrOpen[t])
+      {
+         traceEvent("E", TID_ISR + t, ts, NULL);
+         printf("}");
+      }
+   }
+   printf("\n]}\n");
+}
+
+//Collects trace frames, writes the trace once it ends and returns 1
+int traceFrame(const uint8_t* frame, int len)
+{
+   struct telem_trace_end end;
+   size_t n = (len - 4) / sizeof(struct trace_record);
+
+   if(frame[0] == TELEM_TRACE)
+   {
+      trace = realloc(trace, (traceLen + n) * sizeof(struct trace_record));
+      memcpy(trace + traceLen, frame + 2, n * sizeof(struct trace_record));
+      traceLen += n;
+      return 0;
+   }
+   if(frame[0] != TELEM_TRACE_END || len - 4 != sizeof(end))
+      return 0;
+   memcpy(&end, frame + 2, sizeof(end));
+   if(!end.countsPerUs)
+      return 0;
+   writeTrace(&end);
+   return 1;
+}
+
+//Prints one decoded frame of |len| bytes
+void printFrame(const uint8_t* frame, int len)
+{
+   struct packet* packet = NULL;
+   const uint8_t* payload = frame + 2;
+   int i;
+
+   for(i = 0; i < COUNT(packets); i++)
+      if(packets[i].type == frame[0])
+         packet = &packets[i];
+   //Newer firmware may send types this tool does not know yet
+   if(!packet || (size_t)(len - 4) != packet->size)
+      return;
+
+   if(csv)
+   {
+      if(!packet->headerDone)
+      {
+         printf("type,seq");
+         for(i = 0; i < packet->fieldCount; i++)
+            printf(",%s", packet->fields[i].name);
+         printf("\n");
+         packet->headerDone = 1;
+      }
+      printf("%s,%u", packet->name, frame[1]);
+      for(i = 0; i < packet->fieldCount; i++)
+         printf(",%lu", readValue(payload + packet->fields[i].offset, packet->fields[i].size));
+      printf("\n");
+   }
+   else
+   {
+      printf("{\"type\":\"%s\",\"seq\":%u", packet->name, frame[1]);
+      for(i = 0; i < packet->fieldCount; i++)
+         printf(",\"%s\":%lu", packet->fields[i].name,
+            readValue(payload + packet->fields[i].offset, packet->fields[i].size));
+      printf("}\n");
+   }
+   fflush(stdout);
+}
+
+//Puts a serial port in raw 8N1 at the player's 115200 baud
+void setupTty(int fd)
+{
+   struct termios tio;
+
+   if(tcgetattr(fd, &tio))
+      return;
+   cfmakeraw(&tio);
+   cfsetispeed(&tio, B115200);
+   cfsetospeed(&tio, B115200);
+   tio.c_cc[VMIN] = 1;
+   tio.c_cc[VTIME] = 0;
+   tcsetattr(fd, TCSANOW, &tio);
+}
+
+int main(int argc, char** argv)
+{
+   uint8_t buf[TELEM_MAX_PAYLOAD + 8];
+   uint8_t c;
+   int opt, fd = 0, len = 0, overflow = 0, synced = 0, decoded;
+
+   while((opt = getopt(argc, argv, "ct")) != -1)
+   {
+      if(opt == 'c')
+         csv = 1;
+      else if(opt == 't')
+         traceMode = 1;
+      else
+      {
+         fprintf(stderr, "usage: %s [-c | -t] [serial port or capture]\n", argv[0]);
+         return 2;
+      }
+   }
+   if(optind < argc)
+   {
+      fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+      if(fd < 0)
+      {
+         perror(argv[optind]);
+         return 1;
+      }
+   }
+   if(isatty(fd))
+      setupTty(fd);
+
+   //The screen's escape codes or half a frame may come first, so nothing
+   //counts as bad until a frame has decoded
+   while(read(fd, &c, 1) == 1)
+   {
+      if(c)
+      {
+         if(len < (int)sizeof(buf))
+            buf[len++] = c;
+         else
+            overflow = 1;
+         continue;
+      }
+      //An empty frame is only there to resynchronise
+      if(!len && !overflow)
+         continue;
+      decoded = overflow ? -1 : cobsDecode(buf, len);
+      if(decoded >= 4 && crcCcitt(0xFFFF, buf, decoded - 2) == readValue(buf + decoded - 2, 2))
+      {
+         if(!traceMode)
+            printFrame(buf, decoded);
+         else if(traceFrame(buf, decoded))
+            break;
+         synced = 1;
+      }
+      else if(synced)
+         badFrames++;
+      len = 0;
+      overflow = 0;
+   }
+   if(badFrames)
+      fprintf(stderr, "%lu bad frames\n", badFrames);
+   return 0;
+}
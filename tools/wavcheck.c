@@ -0,0 +1,197 @@
+//Checks wavOpen() against hand built headers, the edge cases a card full of
+//files from anywhere will have: odd sized and oversized chunks, missing or
+//short formats, data cut short, and rates faster than the tick
+//The files are read from memory, extReadFile() below stands in for ext.c
+//
+//   make check
+#include <stdio.h>
+#include <string.h>
+#include "../wav.h"
+
+uint8_t image[256];
+uint16_t imageLen;
+
+//Reads like extReadFile(), short at the end of the file
+uint16_t extReadFile(struct ext_file* file, uint32_t pos, uint8_t* dst, uint16_t count)
+{
+   if(pos >= file->size)
+      return 0;
+   if(count > file->size - pos)
+      count = file->size - pos;
+   memcpy(dst, image + pos, count);
+   return count;
+}
+
+void put(const void* bytes, uint16_t len)
+{
+   memcpy(image + imageLen, bytes, len);
+   imageLen += len;
+}
+
+void put16(uint16_t v)
+{
+   uint8_t b[2] = {v, v >> 8};
+   put(b, 2);
+}
+
+void put32(uint32_t v)
+{
+   put16(v);
+   put16(v >> 16);
+}
+
+//Starts a file with the RIFF header, the RIFF size isn't read
+void riff()
+{
+   imageLen = 0;
+   put("RIFF", 4);
+   put32(0);
+   put("WAVE", 4);
+}
+
+void chunk(const char* id, uint32_t size)
+{
+   put(id, 4);
+   put32(size);
+}
+
+void fmt(uint16_t format, uint16_t channels, uint32_t rate, uint16_t bits, uint16_t blockAlign)
+{
+   chunk("fmt ", 16);
+   put16(format);
+   put16(channels);
+   put32(rate);
+   put32(rate * blockAlign);
+   put16(blockAlign);
+   put16(bits);
+}
+
+//A whole PCM header and |samples| bytes of data
+void pcm(uint16_t channels, uint32_t rate, uint16_t bits, uint16_t samples)
+{
+   uint16_t i;
+
+   riff();
+   fmt(WAV_FORMAT_PCM, channels, rate, bits, channels * bits / 8);
+   chunk("data", samples);
+   for(i = 0; i < samples; i++)
+      image[imageLen++] = i;
+}
+
+struct ext_file file;
+struct wav_info wav;
+int failed, checks;
+
+uint8_t openWav(uint32_t size)
+{
+   file.size = size;
+   memset(&wav, 0, sizeof(wav));
+   return wavOpen(&file, &wav);
+}
+
+void expect(const char* name, uint32_t got, uint32_t want)
+{
+   checks++;
+   if(got == want)
+      return;
+   printf("  %s: %lu, expected %lu\n", name, (unsigned long)got, (unsigned long)want);
+   failed++;
+}
+
+int main()
+{
+   uint8_t out[8];
+
+   //Not a RIFF file, plays raw at the default rate
+   imageLen = 0;
+   put("not a wav file", 14);
+   expect("raw opens", openWav(imageLen), 1);
+   expect("raw data start", wav.dataStart, 0);
+   expect("raw data size", wav.dataSize, imageLen);
+
+   //Plain 8-bit mono
+   pcm(1, 11025, 8, 20);
+   expect("pcm opens", openWav(imageLen), 1);
+   expect("pcm data start", wav.dataStart, 44);
+   expect("pcm data size", wav.dataSize, 20);
+   expect("pcm not decimated", wav.decimate, 1);
+
+   //A data size from an interrupted write is cut to the file
+   expect("long data opens", openWav(imageLen - 5), 1);
+   expect("long data size", wav.dataSize, 15);
+
+   //An odd sized chunk is padded to the next even byte
+   riff();
+   chunk("LIST", 3);
+   put("abc\0", 4);
+   fmt(WAV_FORMAT_PCM, 1, 8000, 8, 1);
+   chunk("data", 4);
+   put("wxyz", 4);
+   expect("odd chunk opens", openWav(imageLen), 1);
+   expect("odd chunk data start", wav.dataStart, imageLen - 4);
+
+   //The same chunk last in the file, nothing after the pad byte to read
+   riff();
+   fmt(WAV_FORMAT_PCM, 1, 8000, 8, 1);
+   chunk("LIST", 3);
+   put("abc", 3);
+   expect("odd chunk at the end", openWav(imageLen), 0);
+
+   //A chunk size past the end of the file, which used to wrap the walk back
+   //to the start of the file, here onto a data header inside the LIST chunk
+   riff();
+   chunk("LIST", 8);
+   chunk("data", 4);
+   fmt(WAV_FORMAT_PCM, 1, 8000, 8, 1);
+   chunk("junk", 0x100000000 - (imageLen + 8 - 20));
+   expect("oversized chunk", openWav(imageLen), 0);
+   riff();
+   chunk("junk", 9);
+   put("12345678", 8);
+   expect("chunk one past the end", openWav(imageLen), 0);
+
+   //A format that is missing or too short to read
+   riff();
+   chunk("data", 4);
+   put("wxyz", 4);
+   expect("no format", openWav(imageLen), 0);
+   riff();
+   chunk("fmt ", 14);
+   put("12345678901234", 14);
+   chunk("data", 4);
+   put("wxyz", 4);
+   expect("short format", openWav(imageLen), 0);
+
+   //Faster than the tick, every second frame of 16-bit stereo plays
+   pcm(2, 44100, 16, 16);
+   expect("44.1 kHz opens", openWav(imageLen), 1);
+   expect("44.1 kHz decimation", wav.decimate, 2);
+   expect("44.1 kHz output rate", wavOutputRate(&wav), 22050);
+   expect("44.1 kHz bytes per sample", wavBytesFor(&wav, 1), 8);
+   //Frames are 0 1 2 3, 4 5 6 7, ... the high bytes average then flip
+   expect("44.1 kHz samples", wavConvert(&wav, image + wav.dataStart, 16, out), 2);
+   expect("44.1 kHz first sample", out[0], ((1 + 3) >> 1) ^ 0x80);
+   expect("44.1 kHz second sample", out[1], ((9 + 11) >> 1) ^ 0x80);
+
+   //Groups of three frames at 48 kHz, a partial group gives nothing
+   pcm(1, 48000, 8, 7);
+   expect("48 kHz opens", openWav(imageLen), 1);
+   expect("48 kHz output rate", wavOutputRate(&wav), 16000);
+   expect("48 kHz samples", wavConvert(&wav, image + wav.dataStart, 7, out), 2);
+   expect("48 kHz second sample", out[1], 3);
+
+   //ADPCM can't skip samples, faster files are refused
+   riff();
+   fmt(WAV_FORMAT_IMA_ADPCM, 1, 44100, 4, 36);
+   chunk("data", 36);
+   imageLen += 36;
+   expect("44.1 kHz ADPCM", openWav(imageLen), 0);
+   riff();
+   fmt(WAV_FORMAT_IMA_ADPCM, 1, 22050, 4, 36);
+   chunk("data", 36);
+   imageLen += 36;
+   expect("22.05 kHz ADPCM", openWav(imageLen), 1);
+
+   printf("wav: %d checks, %d failed\n", checks, failed);
+   return failed != 0;
+}
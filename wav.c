@@ -0,0 +1,235 @@
+#include <string.h>
+#include "wav.h"
+#include "os.h"
+
+#define RIFF_HEADER_SIZE 12
+#define CHUNK_HEADER_SIZE 8
+#define FMT_SIZE 16
+
+static uint8_t wavSupported(struct wav_info* wav);
+
+struct riff_chunk {
+   char id[4];
+   uint32_t size;
+};
+
+struct wav_fmt {
+   uint16_t format;
+   uint16_t channels;
+   uint32_t sampleRate;
+   uint32_t byteRate;
+   uint16_t blockAlign;
+   uint16_t bits;
+};
+
+//Fills in |wav| from the RIFF header of |file|
+//Files without a RIFF header play as raw 8-bit mono at the default tick rate
+//Returns 0 if the file is a WAV the player can't convert
+uint8_t wavOpen(struct ext_file* file, struct wav_info* wav)
+{
+   uint8_t header[RIFF_HEADER_SIZE];
+   struct riff_chunk chunk;
+   struct wav_fmt fmt;
+   uint32_t pos = RIFF_HEADER_SIZE;
+   uint8_t haveFmt = 0;
+
+   wav->format = WAV_FORMAT_PCM;
+   wav->channels = 1;
+   wav->bits = 8;
+   wav->blockAlign = 1;
+   wav->sampleRate = TICK_HZ;
+   wav->dataStart = 0;
+   wav->dataSize = file->size;
+
+   if(extReadFile(file, 0, header, RIFF_HEADER_SIZE) != RIFF_HEADER_SIZE
+         || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4))
+      return 1;
+
+   //Walk the chunks until the sample data, picking up the format on the way
+   while(pos < file->size
+         && extReadFile(file, pos, (uint8_t*)&chunk, CHUNK_HEADER_SIZE) == CHUNK_HEADER_SIZE)
+   {
+      pos += CHUNK_HEADER_SIZE;
+      if(!memcmp(chunk.id, "data", 4))
+      {
+         wav->dataStart = pos;
+         wav->dataSize = chunk.size;
+         //Trust the file size over a header from an interrupted write
+         if(wav->dataSize > file->size - pos)
+            wav->dataSize = file->size - pos;
+         break;
+      }
+      //Any other chunk must fit in the file, a size that runs past the end
+      //would also wrap |pos| back into the header
+      if(chunk.size > file->size - pos)
+         return 0;
+      if(!memcmp(chunk.id, "fmt ", 4))
+      {
+         if(chunk.size < FMT_SIZE || extReadFile(file, pos, (uint8_t*)&fmt, FMT_SIZE) != FMT_SIZE)
+            return 0;
+         wav->format = fmt.format;
+         wav->channels = fmt.channels;
+         wav->bits = fmt.bits;
+         wav->blockAlign = fmt.blockAlign;
+         wav->sampleRate = fmt.sampleRate > 0xFFFF ? 0xFFFF : fmt.sampleRate;
+         haveFmt = 1;
+      }
+      //Chunks are padded to an even length
+      pos += chunk.size + (chunk.size & 1);
+   }
+
+   if(!haveFmt || !wav->dataStart)
+      return 0;
+   return wavSupported(wav);
+}
+
+//Fills in |wav| from what the playlist index recorded, without reading the file
+//Returns 0 if it is a WAV the player can't convert
+uint8_t wavOpenIndexed(struct ext_index_audio* audio, struct wav_info* wav)
+{
+   wav->dataStart = audio->dataStart;
+   wav->dataSize = audio->dataSize;
+   wav->format = audio->format;
+   wav->sampleRate = audio->sampleRate;
+   wav->blockAlign = audio->blockAlign;
+   wav->channels = audio->channels;
+   wav->bits = audio->bits;
+   return wavSupported(wav);
+}
+
+//Returns 1 if wavConvert() can handle |wav| and gets the decoder ready for it
+static uint8_t wavSupported(struct wav_info* wav)
+{
+   //PCM faster than the tick keeps every |decimate|th frame
+   wav->decimate = 1;
+   while(wav->sampleRate / wav->decimate > MAX_TICK_HZ)
+      wav->decimate++;
+
+   //Mono IMA ADPCM only, the decoder keeps one channel of state and
+   //decodes every sample
+   if(wav->format == WAV_FORMAT_IMA_ADPCM)
+   {
+      if(wav->channels != 1 || wav->bits != 4 || wav->blockAlign <= ADPCM_HEADER_SIZE
+            || wav->decimate > 1)
+         return 0;
+      adpcmInit(&wav->adpcm, wav->blockAlign);
+      return 1;
+   }
+   if(wav->format != WAV_FORMAT_PCM)
+      return 0;
+   if((wav->bits != 8 && wav->bits != 16) || wav->channels < 1 || wav->channels > 2)
+      return 0;
+   if(wav->blockAlign != wav->channels * (wav->bits / 8))
+      return 0;
+   return 1;
+}
+
+//Returns the rate wavConvert()'s samples play at, the file's own unless
+//it is decimated
+uint16_t wavOutputRate(struct wav_info* wav)
+{
+   return wav->sampleRate / wav->decimate;
+}
+
+//Returns how many bytes of sample data make at most |samples| output samples
+uint16_t wavBytesFor(struct wav_info* wav, uint16_t samples)
+{
+   //Two samples per ADPCM byte, headers only make fewer
+   if(wav->format == WAV_FORMAT_IMA_ADPCM)
+      return samples / 2;
+   return samples * wav->blockAlign * wav->decimate;
+}
+
+//Returns how many output samples an ADPCM block holds, the header carries one
+static uint16_t adpcmBlockSamples(struct wav_info* wav)
+{
+   return (wav->blockAlign - ADPCM_HEADER_SIZE) * 2 + 1;
+}
+
+//Returns the offset into the sample data of the frame playing |ms| into the song
+//ADPCM lands on the start of the block holding it and the decoder is reset for it
+//Past the end gives the size of the data
+uint32_t wavSeek(struct wav_info* wav, uint32_t ms)
+{
+   //Split the multiply so an hour long song doesn't overflow
+   uint32_t samples = (ms / 1000) * wav->sampleRate + (ms % 1000) * wav->sampleRate / 1000;
+   uint32_t offset;
+
+   if(wav->format == WAV_FORMAT_IMA_ADPCM)
+   {
+      offset = samples / adpcmBlockSamples(wav) * wav->blockAlign;
+      adpcmInit(&wav->adpcm, wav->blockAlign);
+   }
+   else
+      offset = samples * wav->blockAlign;
+
+   if(offset > wav->dataSize)
+      offset = wav->dataSize;
+   return offset;
+}
+
+//Returns how many milliseconds into the song |offset| bytes of sample data are
+uint32_t wavMillis(struct wav_info* wav, uint32_t offset)
+{
+   uint32_t samples;
+
+   if(!wav->sampleRate)
+      return 0;
+   if(wav->format == WAV_FORMAT_IMA_ADPCM)
+      samples = offset / wav->blockAlign * adpcmBlockSamples(wav)
+         + (offset % wav->blockAlign) * 2;
+   else
+      samples = offset / wav->blockAlign;
+   return (samples / wav->sampleRate) * 1000 + (samples % wav->sampleRate) * 1000 / wav->sampleRate;
+}
+
+//Converts |bytes| bytes of frames from |src| to unsigned 8-bit mono in |dst|
+//|dst| may be |src| for PCM, output never runs ahead of input
+//16-bit samples keep their high byte, stereo is the average of the channels
+//A decimated file gives one sample for the first of every |decimate| frames
+//ADPCM expands to twice the input and must not be converted in place
+//Returns the number of samples written
+uint16_t wavConvert(struct wav_info* wav, uint8_t* src, uint16_t bytes, uint8_t* dst)
+{
+   uint16_t n, i;
+   uint8_t step;
+
+   if(wav->format == WAV_FORMAT_IMA_ADPCM)
+      return adpcmDecode(&wav->adpcm, src, bytes, dst);
+
+   step = wav->blockAlign * wav->decimate;
+   n = bytes / step;
+   i = n;
+
+   if(wav->bits == 8)
+   {
+      if(wav->channels == 1)
+      {
+         if(step == 1)
+         {
+            if(dst != src)
+               memcpy(dst, src, n);
+            return n;
+         }
+         for(; i; i--, src += step)
+            *dst++ = *src;
+         return n;
+      }
+      //8-bit samples are unsigned, the average stays in range
+      for(; i; i--, src += step)
+         *dst++ = ((uint16_t)src[0] + src[1]) >> 1;
+      return n;
+   }
+
+   //16-bit samples are signed little endian, flipping the top bit of the
+   //high byte makes it the unsigned 8-bit sample
+   if(wav->channels == 1)
+   {
+      for(; i; i--, src += step)
+         *dst++ = src[1] ^ 0x80;
+      return n;
+   }
+   for(; i; i--, src += step)
+      *dst++ = (((int16_t)(int8_t)src[1] + (int8_t)src[3]) >> 1) ^ 0x80;
+   return n;
+}
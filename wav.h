@@ -0,0 +1,30 @@
+#ifndef WAV_H
+#define WAV_H
+#include <stdint.h>
+#include "ext.h"
+#include "adpcm.h"
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_IMA_ADPCM 0x11
+
+struct wav_info {
+   uint32_t dataStart;     //File offset of the first sample
+   uint32_t dataSize;      //Bytes of sample data
+   uint16_t format;
+   uint16_t sampleRate;
+   uint16_t blockAlign;    //Bytes per frame
+   uint8_t channels;
+   uint8_t bits;
+   uint8_t decimate;       //Frames per output sample, more than 1 above MAX_TICK_HZ
+   struct adpcm_state adpcm;
+};
+
+uint8_t wavOpen(struct ext_file* file, struct wav_info* wav);
+uint8_t wavOpenIndexed(struct ext_index_audio* audio, struct wav_info* wav);
+uint16_t wavOutputRate(struct wav_info* wav);
+uint16_t wavBytesFor(struct wav_info* wav, uint16_t samples);
+uint16_t wavConvert(struct wav_info* wav, uint8_t* src, uint16_t bytes, uint8_t* dst);
+uint32_t wavSeek(struct wav_info* wav, uint32_t ms);
+uint32_t wavMillis(struct wav_info* wav, uint32_t offset);
+
+#endif